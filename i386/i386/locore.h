@@ -62,7 +62,7 @@ extern void cpu_shutdown (void);
 
 extern int syscall (void);
 
-extern unsigned int cpu_features[1];
+extern unsigned int cpu_features[2];
 
 #endif // __ASSEMBLER__
 
@@ -96,7 +96,11 @@ extern unsigned int cpu_features[1];
 #define CPU_FEATURE_TM		29
 #define CPU_FEATURE_PBE		31
 
-#define CPU_HAS_FEATURE(feature) (cpu_features[(feature) / 32] & (1 << ((feature) % 32)))
+/* CPUID leaf 7, subleaf 0, EBX */
+#define CPU_FEATURE_ERMS	(32 + 9)
+
+#define CPU_FEATURE_BIT(feature) (1 << ((feature) % 32))
+#define CPU_HAS_FEATURE(feature) (cpu_features[(feature) / 32] & CPU_FEATURE_BIT(feature))
 
 #endif /* _MACHINE__LOCORE_H_ */
 
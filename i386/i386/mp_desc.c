@@ -374,6 +374,13 @@ void paging_setup(){
     set_cr3(kernel_page_dir_addr);
 #endif	/* PAE */
 #ifndef	MACH_HYP
+    if (CPU_HAS_FEATURE(CPU_FEATURE_PGE))
+        set_cr4(get_cr4() | CR4_PGE);
+    /* Let pmap use superpages.  The kernel page directory already
+     * holds superpage entries, so this must precede paging.  */
+    if (CPU_HAS_FEATURE(CPU_FEATURE_PSE))
+        set_cr4(get_cr4() | CR4_PSE);
+
     /* Turn paging on.
      * Also set the WP bit so that on 486 or better processors
      * page-level write protection works in kernel mode.
@@ -381,9 +388,6 @@ void paging_setup(){
     set_cr0(get_cr0() | CR0_PG | CR0_WP);
     set_cr0(get_cr0() & ~(CR0_CD | CR0_NW));
 
-    if (CPU_HAS_FEATURE(CPU_FEATURE_PGE))
-        set_cr4(get_cr4() | CR4_PGE);
-
 #endif	/* MACH_HYP */
 
     flush_instr_queue();
@@ -36,6 +36,7 @@
 #include <vm/vm_kern.h>
 #include <vm/vm_page.h>
 
+#include <i386/locore.h>
 #include <i386/pmap.h>
 #include <i386/model_dep.h>
 #include <mach/machine/vm_param.h>
@@ -68,6 +69,43 @@ pmap_zero_page(phys_addr_t p)
 		pmap_put_mapwindow(map);
 }
 
+/*
+ *	pmap_zero_page_nocache zeros the specified (machine independent)
+ *	page with non-temporal stores, so that the zeros don't evict
+ *	useful data from the caches.  Used to zero pages ahead of time.
+ */
+void
+pmap_zero_page_nocache(phys_addr_t p)
+{
+	assert(p != vm_page_fictitious_addr);
+	vm_offset_t v;
+	unsigned long *addr;
+	pmap_mapwindow_t *map;
+	boolean_t mapped = p >= VM_PAGE_DIRECTMAP_LIMIT;
+	unsigned int i;
+
+	if (!CPU_HAS_FEATURE(CPU_FEATURE_SSE2)) {
+		pmap_zero_page(p);
+		return;
+	}
+
+	if (mapped)
+	{
+		map = pmap_get_mapwindow(INTEL_PTE_W(p));
+		v = map->vaddr;
+	}
+	else
+		v = phystokv(p);
+
+	addr = (unsigned long *) v;
+	for (i = 0; i < PAGE_SIZE / sizeof(*addr); i++)
+		asm volatile("movnti %1, %0" : "=m" (addr[i]) : "r" (0UL));
+	asm volatile("sfence" : : : "memory");
+
+	if (mapped)
+		pmap_put_mapwindow(map);
+}
+
 /*
  *	pmap_copy_page copies the specified (machine independent) pages.
  */
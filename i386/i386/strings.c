@@ -19,18 +19,94 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <i386/locore.h>
+
 #define ARCH_STRING_MEMCPY
 #define ARCH_STRING_MEMMOVE
 #define ARCH_STRING_MEMSET
 #define ARCH_STRING_MEMCMP
 
+/*
+ * Copies at least this large bypass the caches, when the processor
+ * supports non-temporal stores. They are larger than what the caches
+ * could usefully hold anyway.
+ */
+#define STRING_NONTEMPORAL_MIN (256 * 1024)
+
+/*
+ * Without fast string operations (ERMS), byte moves are slow, and
+ * larger buffers are moved by longwords.
+ */
+#define STRING_LONG_MIN 64
+
+static inline int
+string_fast_movsb(void)
+{
+    return CPU_HAS_FEATURE(CPU_FEATURE_ERMS);
+}
+
+/*
+ * Copy n bytes with non-temporal stores, n being a multiple of 16.
+ *
+ * Only general purpose registers are used, so that no floating point
+ * or SIMD state needs to be saved.
+ */
+static void
+string_copy_nontemporal(void *dest, const void *src, size_t n)
+{
+    unsigned long *d;
+    const unsigned long *s;
+    unsigned long a, b, c, e;
+
+    d = dest;
+    s = src;
+
+    for (n /= 4 * sizeof(*d); n != 0; n--) {
+        a = s[0];
+        b = s[1];
+        c = s[2];
+        e = s[3];
+        asm volatile("movnti %4, %0\n"
+                     "movnti %5, %1\n"
+                     "movnti %6, %2\n"
+                     "movnti %7, %3\n"
+                     : "=m" (d[0]), "=m" (d[1]), "=m" (d[2]), "=m" (d[3])
+                     : "r" (a), "r" (b), "r" (c), "r" (e));
+        d += 4;
+        s += 4;
+    }
+
+    asm volatile("sfence" : : : "memory");
+}
+
 #ifdef ARCH_STRING_MEMCPY
 void *
 memcpy(void *dest, const void *src, size_t n)
 {
     void *orig_dest;
+    size_t head, body;
 
     orig_dest = dest;
+
+    if ((n >= STRING_NONTEMPORAL_MIN) && CPU_HAS_FEATURE(CPU_FEATURE_SSE2)) {
+        head = -(unsigned long)dest & 15;
+        n -= head;
+        asm volatile("rep movsb"
+                     : "+D" (dest), "+S" (src), "+c" (head)
+                     : : "memory");
+        body = n & ~(size_t)15;
+        string_copy_nontemporal(dest, src, body);
+        dest += body;
+        src += body;
+        n -= body;
+    } else if ((n >= STRING_LONG_MIN) && !string_fast_movsb()) {
+        body = n / 4;
+        asm volatile("rep movsl"
+                     : "+D" (dest), "+S" (src), "+c" (body)
+                     : : "memory");
+        n &= 3;
+    }
+
     asm volatile("rep movsb"
                  : "+D" (dest), "+S" (src), "+c" (n)
                  : : "memory");
@@ -67,8 +143,19 @@ void *
 memset(void *s, int c, size_t n)
 {
     void *orig_s;
+    size_t body;
 
     orig_s = s;
+
+    if ((n >= STRING_LONG_MIN) && !string_fast_movsb()) {
+        body = n / 4;
+        asm volatile("rep stosl"
+                     : "+D" (s), "+c" (body)
+                     : "a" ((c & 0xff) * 0x01010101U)
+                     : "memory");
+        n &= 3;
+    }
+
     asm volatile("rep stosb"
                  : "+D" (s), "+c" (n)
                  : "a" (c)
@@ -22,6 +22,7 @@
 #include <mach/machine.h> //machine_slot
 #include <i386/vm_param.h> //phystokv
 #include <vm/vm_map_physical.h>
+#include <vm/vm_page.h> //vm_page_load_node...
 #include <kern/debug.h>
 
 volatile ApicLocalUnit* lapic = (void*) 0;
@@ -33,6 +34,12 @@ struct acpi_rsdp *rsdp;
 struct acpi_rsdt *rsdt;
 int acpi_rsdt_n;
 struct acpi_apic *apic;
+struct acpi_srat *srat;
+struct acpi_slit *slit;
+
+//Proximity domain of each memory node
+static uint32_t acpi_numa_domains[VM_PAGE_MAX_NODES];
+static int acpi_numa_ndomains;
 
 static int acpi_get_rsdp();
 
@@ -40,6 +47,7 @@ static int acpi_check_rsdt(struct acpi_rsdt *);
 static int acpi_get_rsdt();
 
 static int acpi_apic_setup();
+static void acpi_numa_setup();
 
 extern struct machine_slot	machine_slot[NCPUS];
 int apic2kernel[256];
@@ -81,11 +89,23 @@ acpi_setup()
             apic = (struct acpi_apic*) phystokv(rsdt->entry[i]);
 
         }
+
+        //Check if the entry contains a SRAT or a SLIT
+        if(memcmp(descr_header->signature, ACPI_SRAT_SIG,
+                    sizeof(descr_header->signature)) == 0)
+            srat = (struct acpi_srat*) phystokv(rsdt->entry[i]);
+
+        if(memcmp(descr_header->signature, ACPI_SLIT_SIG,
+                    sizeof(descr_header->signature)) == 0)
+            slit = (struct acpi_slit*) phystokv(rsdt->entry[i]);
     }
 
     if(acpi_apic_setup())
         return -1;
 
+    //NUMA information is optional, without it all memory is in node 0
+    acpi_numa_setup();
+
     return 0;
 }
 
@@ -301,6 +321,150 @@ acpi_apic_setup(){
 }
 
 
+/* acpi_numa_node() function:
+ *
+ * Return the memory node of a proximity domain, allocating one if create
+ * is set and the domain hasn't been seen yet. Return -1 if there is none.
+ */
+static int
+acpi_numa_node(uint32_t domain, int create){
+
+    int i;
+
+    for(i = 0; i < acpi_numa_ndomains; i++){
+        if(acpi_numa_domains[i] == domain)
+            return i;
+    }
+
+    if(!create || acpi_numa_ndomains == VM_PAGE_MAX_NODES)
+        return -1;
+
+    acpi_numa_domains[acpi_numa_ndomains] = domain;
+    return acpi_numa_ndomains++;
+}
+
+static void
+acpi_srat_setup(){
+
+    uint64_t base, end, limit;
+    uint32_t domain;
+    int node, cpu;
+
+    //Last page address which fits in phys_addr_t
+    limit = (uint64_t) vm_page_trunc((phys_addr_t) -1);
+
+    struct acpi_apic_dhdr *srat_entry = srat->entry;
+    uint32_t srat_end = (uint32_t) srat + srat->header.length;
+
+    //Search in SRAT entry
+    while((uint32_t)srat_entry < srat_end && srat_entry->length != 0){
+        struct acpi_srat_lapic *lapic_entry;
+        struct acpi_srat_memory *memory_entry;
+
+        switch(srat_entry->type){
+
+            //If SRAT entry is a processor, assign It to the node
+            case ACPI_SRAT_ENTRY_LAPIC:
+                lapic_entry = (struct acpi_srat_lapic*) srat_entry;
+
+                if(!(lapic_entry->flags & ACPI_SRAT_ENABLED))
+                    break;
+
+                domain = lapic_entry->domain_lo
+                    | (lapic_entry->domain_hi[0] << 8)
+                    | (lapic_entry->domain_hi[1] << 16)
+                    | (lapic_entry->domain_hi[2] << 24);
+                node = acpi_numa_node(domain, 1);
+                cpu = apic2kernel[lapic_entry->apic_id];
+
+                if(node >= 0 && cpu >= 0)
+                    vm_page_set_cpu_node(cpu, node);
+                break;
+
+            //If SRAT entry is a memory range, load It in the node
+            case ACPI_SRAT_ENTRY_MEMORY:
+                memory_entry = (struct acpi_srat_memory*) srat_entry;
+
+                if(!(memory_entry->flags & ACPI_SRAT_ENABLED))
+                    break;
+
+                base = ((uint64_t) memory_entry->base_hi << 32)
+                    | memory_entry->base_lo;
+                end = base + (((uint64_t) memory_entry->length_hi << 32)
+                    | memory_entry->length_lo);
+
+                //Skip memory which can't be addressed
+                if(end > limit)
+                    end = limit;
+
+                if(base >= end)
+                    break;
+
+                node = acpi_numa_node(memory_entry->domain, 1);
+
+                if(node >= 0)
+                    vm_page_load_node(node, base, end);
+                break;
+        }
+
+        //Get next SRAT entry
+        srat_entry = (struct acpi_apic_dhdr*)((uint32_t) srat_entry
+                + srat_entry->length);
+    }
+}
+
+static void
+acpi_slit_setup(){
+
+    uint32_t count, i, j;
+    int from, to;
+
+    count = slit->count_lo;
+
+    //Check the matrix fits in the table
+    if(slit->count_hi != 0 || count > 256
+       || sizeof(*slit) + count * count > slit->header.length)
+        return;
+
+    for(i = 0; i < count; i++){
+        from = acpi_numa_node(i, 0);
+
+        if(from < 0)
+            continue;
+
+        for(j = 0; j < count; j++){
+            to = acpi_numa_node(j, 0);
+
+            if(to >= 0)
+                vm_page_set_node_distance(from, to,
+                                          slit->entry[i * count + j]);
+        }
+    }
+}
+
+/* acpi_numa_setup() function:
+ *
+ * Must be executed after acpi_apic_setup(), which numbers the processors
+ * Describe the memory nodes found in SRAT and SLIT to the vm_page module
+ */
+static void
+acpi_numa_setup(){
+
+    if(srat == 0 || acpi_checksum(srat, srat->header.length))
+        return;
+
+    acpi_srat_setup();
+
+    if(acpi_numa_ndomains > 1)
+        printf("acpi found %d memory nodes\n", acpi_numa_ndomains);
+
+    if(slit == 0 || acpi_checksum(slit, slit->header.length))
+        return;
+
+    acpi_slit_setup();
+}
+
+
 int extra_setup()
 {
   if (lapic_addr == 0)
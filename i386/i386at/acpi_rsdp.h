@@ -124,6 +124,80 @@ struct acpi_apic_ioapic
 
 
 
+//System Resource Affinity Table signature
+#define ACPI_SRAT_SIG "SRAT"
+
+//Types value for the SRAT structures used
+#define ACPI_SRAT_ENTRY_LAPIC  0
+#define ACPI_SRAT_ENTRY_MEMORY 1
+
+//Flags of the SRAT structures
+#define ACPI_SRAT_ENABLED      0x1
+
+/* System Resource Affinity Table (SRAT)
+ *
+ * Associates processors and memory ranges with proximity domains (NUMA nodes)
+ *
+ * Entry field stores affinity structures, which begin with the same header as
+ * the APIC structures
+ */
+struct acpi_srat
+{
+    struct acpi_dhdr header;
+    uint32_t reserved1;
+    uint8_t reserved2[8];
+    struct acpi_apic_dhdr entry[0];
+} __attribute__((__packed__));
+
+/* Processor Local APIC Affinity Structure
+ *
+ * Stores the proximity domain of a processor, identified by its APIC ID
+ */
+struct acpi_srat_lapic
+{
+    struct acpi_apic_dhdr header;
+    uint8_t domain_lo; //Bits 0-7 of the proximity domain
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t domain_hi[3]; //Bits 8-31 of the proximity domain
+    uint32_t clock_domain;
+} __attribute__((__packed__));
+
+/* Memory Affinity Structure
+ *
+ * Stores the proximity domain of a physical memory range
+ */
+struct acpi_srat_memory
+{
+    struct acpi_apic_dhdr header;
+    uint32_t domain;
+    uint16_t reserved1;
+    uint32_t base_lo;
+    uint32_t base_hi;
+    uint32_t length_lo;
+    uint32_t length_hi;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint8_t reserved3[8];
+} __attribute__((__packed__));
+
+//System Locality Information Table signature
+#define ACPI_SLIT_SIG "SLIT"
+
+/* System Locality Information Table (SLIT)
+ *
+ * Stores the relative distances between proximity domains, as a matrix of
+ * count x count bytes, where entry[i * count + j] is the distance from i to j
+ */
+struct acpi_slit
+{
+    struct acpi_dhdr header;
+    uint32_t count_lo;
+    uint32_t count_hi;
+    uint8_t entry[0];
+} __attribute__((__packed__));
+
 
 int acpi_setup();
 void acpi_print_info();
@@ -503,6 +503,9 @@ i386at_init(void)
     set_cr0(get_cr0() & ~(CR0_CD | CR0_NW));
     if (CPU_HAS_FEATURE(CPU_FEATURE_PGE))
         set_cr4(get_cr4() | CR4_PGE);
+    /* Let pmap use superpages.  */
+    if (CPU_HAS_FEATURE(CPU_FEATURE_PSE))
+        set_cr4(get_cr4() | CR4_PSE);
 #endif	/* MACH_HYP */
     flush_instr_queue();
 #ifdef	MACH_PV_PAGETABLES
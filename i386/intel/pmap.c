@@ -64,8 +64,10 @@
 #include <kern/printf.h>
 #include <kern/thread.h>
 #include <kern/slab.h>
+#include <kern/kalloc.h>
 
 #include <kern/lock.h>
+#include <kern/atomic.h>
 
 #include <vm/pmap.h>
 #include <vm/vm_map.h>
@@ -190,6 +192,54 @@ char	*pmap_phys_attributes;
  */
 #define	PDE_MAPPED_SIZE		(pdenum2lin(1))
 
+/*
+ *	Superpages.
+ *
+ *	A page table mapping an aligned, physically contiguous block
+ *	with identical attributes in every entry is replaced by a single
+ *	page directory entry with INTEL_PTE_PS set (promotion).  The page
+ *	table itself is kept, and the page directory entry which pointed
+ *	to it is saved in the superpage_pdes array of the pmap, so that
+ *	pmap_pte can still look up its entries, and so that the superpage
+ *	can be split back into pages without allocating anything
+ *	(demotion).  Any operation changing part of a superpage demotes
+ *	it first.
+ *
+ *	User pmaps promote page tables as they get filled by pmap_enter,
+ *	once every writable page is dirty: the MMU only sets the modify
+ *	bit of the superpage entry, which can't tell which of the pages
+ *	were written.  The kernel pmap only promotes the direct mapping
+ *	of physical memory, once, from pmap_init.  User page directories
+ *	hold copies of the kernel entries, so demoting a kernel superpage
+ *	also updates every pmap of pmap_list.
+ */
+boolean_t	pmap_superpages_enabled = FALSE;
+unsigned int	pmap_superpage_promotions = 0;	/* statistics */
+unsigned int	pmap_superpage_demotions = 0;	/* statistics */
+
+queue_head_t	pmap_list;		/* all pmaps but the kernel's */
+decl_simple_lock_data(, pmap_list_lock)
+
+#define	pmap_pde_superpage(pde)	\
+	(((pde) & (INTEL_PTE_VALID | INTEL_PTE_PS)) \
+	 == (INTEL_PTE_VALID | INTEL_PTE_PS))
+
+/*
+ *	Lazy write protection.
+ *
+ *	Write-protecting a whole page table of a user pmap, as
+ *	vm_map_fork does for every copy-on-write region of the parent,
+ *	only clears the write bit of its page directory entry, which
+ *	the MMU combines with those of the page table entries, and sets
+ *	INTEL_PTE_WRPROT there.  The entries themselves are
+ *	write-protected, and the directory entry made writable again,
+ *	by pmap_wrprot_apply when pmap_enter next changes one of them,
+ *	usually on the first write fault in the block.  Page tables
+ *	write-protected this way are not promoted to superpages.
+ */
+unsigned int	pmap_wrprot_deferred = 0;	/* statistics */
+unsigned int	pmap_wrprot_applied = 0;	/* statistics */
+
 /*
  *	We allocate page table pages directly from the VM system
  *	through this object.  It maps physical memory.
@@ -293,14 +343,27 @@ lock_data_t	pmap_system_lock;
 	/* Since the pmap is locked, other updates are locked */ \
 	/* out, and any pmap_activate has finished. */ \
  \
-	/* find other cpus using the pmap */ \
+	/* find other cpus using the pmap, before emptying the */ \
+	/* lazy set, which cpus enter before leaving the users */ \
 	users = (pmap)->cpus_using & ~cpu_mask; \
+ \
+	/* cpus keeping the pmap loaded in lazy mode get no */ \
+	/* interrupt, they reload their TLB when using it again */ \
+	if ((pmap)->cpus_lazy) \
+	    (void) atomic_swap_seq(&(pmap)->cpus_lazy, 0); \
+ \
 	if (users) { \
-	    /* signal them, and wait for them to finish */ \
-	    /* using the pmap */ \
-	    signal_cpus(users, (pmap), (s), (e)); \
-	    while ((pmap)->cpus_using & cpus_active & ~cpu_mask) \
-		continue; \
+	    if ((pmap) != kernel_pmap \
+		&& pmap_batch[cpu_number()].depth > 0) { \
+		/* queue the update, pmap_batch_end signals them */ \
+		pmap_batch_defer(users, (pmap), (s), (e)); \
+	    } else { \
+		/* signal them, and wait for them to finish */ \
+		/* using the pmap */ \
+		signal_cpus(users, (pmap), (s), (e)); \
+		while ((pmap)->cpus_using & cpus_active & ~cpu_mask) \
+		    continue; \
+	    } \
 	} \
  \
 	/* invalidate our own TLB if pmap is in use */ \
@@ -342,13 +405,29 @@ lock_data_t	pmap_system_lock;
 } while(0)
 #else	/* MACH_PV_PAGETABLES */
 /* It is hard to know when a TLB flush becomes less expensive than a bunch of
- * invlpgs.  But it surely is more expensive than just one invlpg.  */
+ * invlpgs.  But it surely is more expensive than just one invlpg.
+ * Kernel mappings are global, so that they survive address space switches;
+ * reloading cr3 doesn't flush them.  */
+#define INVALIDATE_TLB_MAX_PAGES	32
+
+#define flush_tlb_global() do { \
+	if (CPU_HAS_FEATURE(CPU_FEATURE_PGE)) { \
+		set_cr4(get_cr4() & ~CR4_PGE); \
+		set_cr4(get_cr4() | CR4_PGE); \
+	} else \
+		flush_tlb(); \
+} while (0)
+
 #define INVALIDATE_TLB(pmap, s, e) do { \
 	if (__builtin_constant_p((e) - (s)) \
 		&& (e) - (s) == PAGE_SIZE) \
 		invlpg_linear((pmap) == kernel_pmap ? kvtolin(s) : (s)); \
-	else \
+	else if ((pmap) != kernel_pmap) \
 		flush_tlb(); \
+	else if ((e) - (s) <= INVALIDATE_TLB_MAX_PAGES * PAGE_SIZE) \
+		invlpg_linear_range(kvtolin(s), kvtolin(e)); \
+	else \
+		flush_tlb_global(); \
 } while (0)
 #endif	/* MACH_PV_PAGETABLES */
 
@@ -369,8 +448,9 @@ struct pmap_update_item {
 typedef	struct pmap_update_item	*pmap_update_item_t;
 
 /*
- *	List of pmap updates.  If the list overflows,
- *	the last entry is changed to invalidate all.
+ *	List of pmap updates.  Updates of the same pmap are merged.
+ *	If the list overflows, the last entry is changed to
+ *	invalidate all.
  */
 struct pmap_update_list {
 	decl_simple_lock_data(,	lock)
@@ -381,6 +461,25 @@ typedef	struct pmap_update_list	*pmap_update_list_t;
 
 struct pmap_update_list	cpu_update_list[NCPUS];
 
+/*
+ *	Gathered TLB shootdowns of each cpu, see pmap_batch_begin.
+ */
+struct pmap_batch {
+	int		depth;		/* nesting of batches */
+	cpu_set		cpus;		/* cpus with deferred updates */
+} ;
+
+struct pmap_batch	pmap_batch[NCPUS];
+
+volatile pmap_t		cpu_lazy_pmap[NCPUS];
+
+static void pmap_batch_defer(
+	cpu_set		use_list,
+	pmap_t		pmap,
+	vm_offset_t	start,
+	vm_offset_t	end);
+static void pmap_lazy_release(pmap_t pmap);
+
 #endif	/* NCPUS > 1 */
 
 /*
@@ -437,11 +536,31 @@ pmap_pde(const pmap_t pmap, vm_offset_t addr)
 	return &page_dir[lin2pdenum(addr)];
 }
 
+/*
+ *	Return the saved page directory entry of the superpage
+ *	mapping addr.  The kernel entries of a user pmap are
+ *	copies of those of the kernel pmap.
+ */
+static inline pt_entry_t *
+pmap_superpage_saved_pde(pmap_t pmap, vm_offset_t addr)
+{
+	if (pmap == kernel_pmap)
+		addr = kvtolin(addr);
+	else if (addr >= LINEAR_MIN_KERNEL_ADDRESS)
+		pmap = kernel_pmap;
+	assert(pmap->superpage_pdes != PT_ENTRY_NULL);
+	return &pmap->superpage_pdes[lin2pdenum_cont(addr)];
+}
+
 /*
  *	Given an offset and a map, compute the address of the
  *	pte.  If the address is invalid with respect to the map
  *	then PT_ENTRY_NULL is returned (and the map may need to grow).
  *
+ *	Within a superpage, the entry returned is the one of the
+ *	saved page table, which the MMU doesn't use: callers changing
+ *	it must demote the superpage first.
+ *
  *	This is only used internally.
  */
 pt_entry_t *
@@ -460,10 +579,267 @@ pmap_pte(const pmap_t pmap, vm_offset_t addr)
 	pte = *pmap_pde(pmap, addr);
 	if ((pte & INTEL_PTE_VALID) == 0)
 		return(PT_ENTRY_NULL);
+	if (pte & INTEL_PTE_PS)
+		pte = *pmap_superpage_saved_pde(pmap, addr);
 	ptp = (pt_entry_t *)ptetokv(pte);
 	return(&ptp[ptenum(addr)]);
 }
 
+/*
+ *	Routine:	pmap_superpage_pde
+ *	Function:
+ *		Return the superpage page directory entry which can
+ *		replace the given page table, or 0 if its entries
+ *		don't map an aligned, physically contiguous block
+ *		with identical attributes.  If dirty is true, the
+ *		entries must also be modified, or read-only.
+ */
+static pt_entry_t
+pmap_superpage_pde(
+	const pt_entry_t	*ptp,
+	boolean_t		dirty)
+{
+	pt_entry_t	first, attrs, bits, pte;
+	unsigned int	i;
+
+	first = ptp[0];
+	if (!(first & INTEL_PTE_VALID)
+	    || ((first & INTEL_PTE_PFN) & (PDE_MAPPED_SIZE - 1)))
+		return 0;
+
+	attrs = first & ~(INTEL_PTE_PFN | INTEL_PTE_REF | INTEL_PTE_MOD);
+	if (!(attrs & INTEL_PTE_WRITE))
+		dirty = FALSE;
+	bits = 0;
+
+	for (i = 0; i < NPTES; i++) {
+		pte = ptp[i];
+		if ((pte & ~(INTEL_PTE_PFN | INTEL_PTE_REF | INTEL_PTE_MOD))
+			!= attrs
+		    || (pte & INTEL_PTE_PFN)
+			!= (first & INTEL_PTE_PFN) + i * INTEL_PGBYTES
+		    || (dirty && !(pte & INTEL_PTE_MOD)))
+			return 0;
+		bits |= pte & (INTEL_PTE_REF | INTEL_PTE_MOD);
+	}
+
+	return (first & INTEL_PTE_PFN) | attrs | bits | INTEL_PTE_PS;
+}
+
+/*
+ *	Routine:	pmap_demote
+ *	Function:
+ *		Split the superpage mapping va, if any, back into
+ *		the pages of its saved page table.
+ *	In/out conditions:
+ *		The pmap must be locked.  Nothing is allocated.
+ */
+static void
+pmap_demote(
+	pmap_t		pmap,
+	vm_offset_t	va)
+{
+	pt_entry_t	*pdp, *saved, *ptp;
+	pt_entry_t	pde;
+	unsigned int	i;
+	pmap_t		p;
+
+	pdp = pmap_pde(pmap, va);
+	pde = *pdp;
+	if (!pmap_pde_superpage(pde))
+		return;
+
+	saved = pmap_superpage_saved_pde(pmap, va);
+	ptp = (pt_entry_t *) ptetokv(*saved);
+
+	/*
+	 *	The saved entries lack the reference bit the MMU
+	 *	set in the superpage entry.  They keep their own
+	 *	modify bits, which promotion required to be set
+	 *	on writable entries.
+	 */
+	if (pde & INTEL_PTE_REF)
+		for (i = 0; i < NPTES; i++)
+			ptp[i] |= INTEL_PTE_REF;
+
+	WRITE_PTE(pdp, *saved);
+
+	if (pmap == kernel_pmap) {
+		simple_lock(&pmap_list_lock);
+		queue_iterate(&pmap_list, p, pmap_t, list)
+			WRITE_PTE(pmap_pde(p, kvtolin(va)), *saved);
+		simple_unlock(&pmap_list_lock);
+	}
+
+	*saved = 0;
+
+	va &= ~(PDE_MAPPED_SIZE - 1);
+	PMAP_UPDATE_TLBS(pmap, va, va + PDE_MAPPED_SIZE);
+	pmap_superpage_demotions++;
+}
+
+/*
+ *	Routine:	pmap_copy_kernel_demotions
+ *	Function:
+ *		Demote the copies of kernel superpage entries in the
+ *		page directory of a new pmap whose kernel superpage
+ *		was demoted since they were made.
+ *	In/out conditions:
+ *		The pmap list is locked.
+ */
+static void
+pmap_copy_kernel_demotions(pmap_t pmap)
+{
+	pt_entry_t	*pdp;
+	vm_offset_t	va, end;
+
+	end = phystokv(biosmem_directmap_end());
+	for (va = phystokv(0); va < end; va += PDE_MAPPED_SIZE) {
+		pdp = pmap_pde(pmap, kvtolin(va));
+		if (pmap_pde_superpage(*pdp))
+			WRITE_PTE(pdp, *pmap_pde(kernel_pmap, va));
+	}
+}
+
+/*
+ *	Routine:	pmap_promote
+ *	Function:
+ *		Replace the page table of the block containing va
+ *		by a superpage, if it qualifies.
+ *	In/out conditions:
+ *		The pmap must be unlocked.  The array of saved
+ *		page directory entries is allocated if needed.
+ */
+static void
+pmap_promote(
+	pmap_t		pmap,
+	vm_offset_t	va)
+{
+	pt_entry_t	*pdp, *saved;
+	pt_entry_t	pde, new_pde;
+	int		spl;
+
+	assert(pmap != kernel_pmap);
+
+	if (pmap->superpage_pdes == PT_ENTRY_NULL) {
+		saved = (pt_entry_t *) kalloc(NPDES * sizeof(pt_entry_t));
+		if (saved == PT_ENTRY_NULL)
+			return;
+		memset(saved, 0, NPDES * sizeof(pt_entry_t));
+
+		PMAP_READ_LOCK(pmap, spl);
+		if (pmap->superpage_pdes == PT_ENTRY_NULL) {
+			pmap->superpage_pdes = saved;
+			saved = PT_ENTRY_NULL;
+		}
+		PMAP_READ_UNLOCK(pmap, spl);
+
+		if (saved != PT_ENTRY_NULL)
+			kfree((vm_offset_t) saved, NPDES * sizeof(pt_entry_t));
+	}
+
+	va &= ~(PDE_MAPPED_SIZE - 1);
+
+	PMAP_READ_LOCK(pmap, spl);
+	pdp = pmap_pde(pmap, va);
+	pde = *pdp;
+	if ((pde & INTEL_PTE_VALID)
+	    && !(pde & (INTEL_PTE_PS | INTEL_PTE_WRPROT))) {
+		new_pde = pmap_superpage_pde((pt_entry_t *) ptetokv(pde),
+					     TRUE);
+		if (new_pde != 0) {
+			*pmap_superpage_saved_pde(pmap, va) = pde;
+			WRITE_PTE(pdp, new_pde);
+			PMAP_UPDATE_TLBS(pmap, va, va + PDE_MAPPED_SIZE);
+			pmap_superpage_promotions++;
+		}
+	}
+	PMAP_READ_UNLOCK(pmap, spl);
+}
+
+#ifndef	MACH_PV_PAGETABLES
+/*
+ *	Routine:	pmap_wrprot_apply
+ *	Function:
+ *		Write-protect the entries of the page table mapping
+ *		va if only its page directory entry was, and make
+ *		that entry writable again.
+ *	In/out conditions:
+ *		The pmap must be locked.
+ */
+static void
+pmap_wrprot_apply(
+	pmap_t		pmap,
+	vm_offset_t	va)
+{
+	pt_entry_t	*pdp, *ptp, *eptp;
+
+	pdp = pmap_pde(pmap, va);
+	if (!(*pdp & INTEL_PTE_WRPROT))
+		return;
+
+	ptp = (pt_entry_t *) ptetokv(*pdp);
+	for (eptp = &ptp[NPTES]; ptp < eptp; ptp++)
+		*ptp &= ~INTEL_PTE_WRITE;
+
+	WRITE_PTE(pdp, (*pdp & ~INTEL_PTE_WRPROT) | INTEL_PTE_WRITE);
+
+	va &= ~(PDE_MAPPED_SIZE - 1);
+	PMAP_UPDATE_TLBS(pmap, va, va + PDE_MAPPED_SIZE);
+	pmap_wrprot_applied++;
+}
+#endif	/* MACH_PV_PAGETABLES */
+
+/*
+ *	Routine:	pmap_promote_directmap
+ *	Function:
+ *		Map the direct mapping of physical memory with
+ *		superpages where possible.
+ *	In/out conditions:
+ *		Called once from pmap_init, before other processors
+ *		and user pmaps exist.
+ */
+static void
+pmap_promote_directmap(void)
+{
+	pt_entry_t	*pdp;
+	pt_entry_t	new_pde;
+	vm_offset_t	va, end, addr;
+	vm_size_t	size;
+
+	size = round_page(NPDES * sizeof(pt_entry_t));
+	if (kmem_alloc_wired(kernel_map, &addr, size) != KERN_SUCCESS)
+		return;
+	memset((void *) addr, 0, size);
+	kernel_pmap->superpage_pdes = (pt_entry_t *) addr;
+
+	/*
+	 *	Skip the first block, page zero is unmapped later
+	 *	by pmap_unmap_page_zero.
+	 */
+	end = phystokv(biosmem_directmap_end()) & ~(PDE_MAPPED_SIZE - 1);
+	for (va = phystokv(PDE_MAPPED_SIZE); va < end; va += PDE_MAPPED_SIZE) {
+		pdp = pmap_pde(kernel_pmap, va);
+		if (!(*pdp & INTEL_PTE_VALID) || (*pdp & INTEL_PTE_PS))
+			continue;
+
+		/*
+		 *	Read-only blocks hold kernel text, whose protection
+		 *	the kernel debugger changes page by page.
+		 */
+		new_pde = pmap_superpage_pde((pt_entry_t *) ptetokv(*pdp),
+					     FALSE);
+		if (!(new_pde & INTEL_PTE_WRITE))
+			continue;
+
+		*pmap_superpage_saved_pde(kernel_pmap, va) = *pdp;
+		WRITE_PTE(pdp, new_pde);
+		pmap_superpage_promotions++;
+	}
+
+	flush_tlb();
+}
+
 #define DEBUG_PTE_PAGE	0
 
 #if	DEBUG_PTE_PAGE
@@ -617,6 +993,9 @@ void pmap_bootstrap(void)
 
 	kernel_pmap->ref_count = 1;
 
+	queue_init(&pmap_list);
+	simple_lock_init(&pmap_list_lock);
+
 	/*
 	 * Determine the kernel virtual address range.
 	 * It starts at the end of the physical memory
@@ -1013,6 +1392,21 @@ void pmap_init(void)
 	s = (vm_size_t) sizeof(struct pv_entry);
 	kmem_cache_init(&pv_list_cache, "pv_entry", s, 0, NULL, 0);
 
+	/*
+	 *	Superpages need PSE, which PAE implies.  They aren't
+	 *	supported with paravirtualized page tables.
+	 */
+#ifndef	MACH_PV_PAGETABLES
+#if PAE
+	pmap_superpages_enabled = TRUE;
+#else	/* PAE */
+	pmap_superpages_enabled = CPU_HAS_FEATURE(CPU_FEATURE_PSE);
+#endif	/* PAE */
+#endif	/* MACH_PV_PAGETABLES */
+
+	if (pmap_superpages_enabled)
+		pmap_promote_directmap();
+
 #if	NCPUS > 1
 	/*
 	 *	Set up the pmap request lists
@@ -1170,6 +1564,7 @@ pmap_t pmap_create(vm_size_t size)
 {
 	pt_entry_t		*page_dir[PDPNUM];
 	int			i;
+	int			s;
 	pmap_t			p;
 	pmap_statistics_t	stats;
 
@@ -1253,6 +1648,8 @@ pmap_t pmap_create(vm_size_t size)
 
 	simple_lock_init(&p->lock);
 	p->cpus_using = 0;
+	p->cpus_lazy = 0;
+	p->superpage_pdes = PT_ENTRY_NULL;
 
 	/*
 	 *	Initialize statistics.
@@ -1262,6 +1659,20 @@ pmap_t pmap_create(vm_size_t size)
 	stats->resident_count = 0;
 	stats->wired_count = 0;
 
+	/*
+	 *	Join the pmaps updated by kernel demotions, and catch
+	 *	up with those made since the kernel page directory
+	 *	was copied.
+	 */
+
+	SPLVM(s);
+	simple_lock(&pmap_list_lock);
+	queue_enter(&pmap_list, p, pmap_t, list);
+	if (pmap_superpages_enabled)
+		pmap_copy_kernel_demotions(p);
+	simple_unlock(&pmap_list_lock);
+	SPLX(s);
+
 	return(p);
 }
 
@@ -1273,9 +1684,7 @@ pmap_t pmap_create(vm_size_t size)
 
 void pmap_destroy(pmap_t p)
 {
-#if PAE
 	int		i;
-#endif
 	boolean_t	free_all;
 	pt_entry_t     	*page_dir;
 	pt_entry_t	*pdep;
@@ -1296,11 +1705,22 @@ void pmap_destroy(pmap_t p)
 	    return;	/* still in use */
 	}
 
+	SPLVM(s);
+	simple_lock(&pmap_list_lock);
+	queue_remove(&pmap_list, p, pmap_t, list);
+	simple_unlock(&pmap_list_lock);
+	SPLX(s);
+
+#if	NCPUS > 1
+	pmap_lazy_release(p);
+#endif	/* NCPUS > 1 */
+
 #if PAE
 	for (i = 0; i <= lin2pdpnum(LINEAR_MIN_KERNEL_ADDRESS); i++) {
 	    free_all = i < lin2pdpnum(LINEAR_MIN_KERNEL_ADDRESS);
 	    page_dir = (pt_entry_t *) ptetokv(p->pdpbase[i]);
 #else
+	    i = 0;
 	    free_all = FALSE;
 	    page_dir = p->dirbase;
 #endif
@@ -1315,7 +1735,12 @@ void pmap_destroy(pmap_t p)
 		     && pdep < &page_dir[NPTES];
 		 pdep += ptes_per_vm_page) {
 		if (*pdep & INTEL_PTE_VALID) {
-		    pa = pte_to_pa(*pdep);
+		    if (*pdep & INTEL_PTE_PS)
+			pa = pte_to_pa(*pmap_superpage_saved_pde(p,
+					pdenum2lin(pdep - page_dir
+						   + i * NPTES)));
+		    else
+			pa = pte_to_pa(*pdep);
 		    vm_object_lock(pmap_object);
 		    m = vm_page_lookup(pmap_object, pa);
 		    if (m == VM_PAGE_NULL)
@@ -1344,6 +1769,9 @@ void pmap_destroy(pmap_t p)
 #endif	/* MACH_PV_PAGETABLES */
 	kmem_cache_free(&pdpt_cache, (vm_offset_t) p->pdpbase);
 #endif	/* PAE */
+	if (p->superpage_pdes != PT_ENTRY_NULL)
+		kfree((vm_offset_t) p->superpage_pdes,
+		      NPDES * sizeof(pt_entry_t));
 	kmem_cache_free(&pmap_cache, (vm_offset_t) p);
 }
 
@@ -1541,11 +1969,13 @@ void pmap_remove(
 	pt_entry_t		*spte, *epte;
 	vm_offset_t		l;
 	vm_offset_t		_s = s;
+	unsigned long		resident;
 
 	if (map == PMAP_NULL)
 		return;
 
 	PMAP_READ_LOCK(map, spl);
+	resident = map->stats.resident_count;
 
 	while (s < e) {
 	    pt_entry_t *pde = pmap_pde(map, s);
@@ -1553,6 +1983,7 @@ void pmap_remove(
 	    l = (s + PDE_MAPPED_SIZE) & ~(PDE_MAPPED_SIZE-1);
 	    if (l > e)
 		l = e;
+	    pmap_demote(map, s);
 	    if (*pde & INTEL_PTE_VALID) {
 		spte = (pt_entry_t *)ptetokv(*pde);
 		spte = &spte[ptenum(s)];
@@ -1561,7 +1992,12 @@ void pmap_remove(
 	    }
 	    s = l;
 	}
-	PMAP_UPDATE_TLBS(map, _s, e);
+
+	/*
+	 *	Don't signal other cpus if nothing was mapped.
+	 */
+	if (map->stats.resident_count != resident)
+	    PMAP_UPDATE_TLBS(map, _s, e);
 
 	PMAP_READ_UNLOCK(map, spl);
 }
@@ -1636,6 +2072,7 @@ void pmap_page_protect(
 		simple_lock(&pmap->lock);
 
 		va = pv_e->va;
+		pmap_demote(pmap, va);
 		pte = pmap_pte(pmap, va);
 
 		/*
@@ -1749,6 +2186,7 @@ void pmap_protect(
 	vm_offset_t	l;
 	int		spl;
 	vm_offset_t	_s = s;
+	boolean_t	changed = FALSE;
 
 	if (map == PMAP_NULL)
 		return;
@@ -1788,6 +2226,41 @@ void pmap_protect(
 	    l = (s + PDE_MAPPED_SIZE) & ~(PDE_MAPPED_SIZE-1);
 	    if (l > e)
 		l = e;
+	    if (pmap_pde_superpage(*pde)) {
+		if ((l - s) == PDE_MAPPED_SIZE) {
+		    /*
+		     * Write-protect the whole superpage, and its
+		     * saved page table along.
+		     */
+		    spte = (pt_entry_t *)
+			ptetokv(*pmap_superpage_saved_pde(map, s));
+		    epte = &spte[NPTES];
+		    while (spte < epte)
+			*spte++ &= ~INTEL_PTE_WRITE;
+		    *pde &= ~INTEL_PTE_WRITE;
+		    changed = TRUE;
+		    s = l;
+		    pde++;
+		    continue;
+		}
+		pmap_demote(map, s);
+	    }
+#ifndef	MACH_PV_PAGETABLES
+	    if ((*pde & INTEL_PTE_VALID) && (l - s) == PDE_MAPPED_SIZE) {
+		/*
+		 * Write-protect the whole page table from its
+		 * directory entry, see pmap_wrprot_apply.
+		 */
+		if (*pde & INTEL_PTE_WRITE) {
+		    *pde = (*pde & ~INTEL_PTE_WRITE) | INTEL_PTE_WRPROT;
+		    pmap_wrprot_deferred++;
+		    changed = TRUE;
+		}
+		s = l;
+		pde++;
+		continue;
+	    }
+#endif	/* MACH_PV_PAGETABLES */
 	    if (*pde & INTEL_PTE_VALID) {
 		spte = (pt_entry_t *)ptetokv(*pde);
 		spte = &spte[ptenum(s)];
@@ -1799,7 +2272,9 @@ void pmap_protect(
 #endif	/* MACH_PV_PAGETABLES */
 
 		while (spte < epte) {
-		    if (*spte & INTEL_PTE_VALID) {
+		    if ((*spte & (INTEL_PTE_VALID | INTEL_PTE_WRITE))
+			== (INTEL_PTE_VALID | INTEL_PTE_WRITE)) {
+			changed = TRUE;
 #ifdef	MACH_PV_PAGETABLES
 			update[i].ptr = kv_to_ma(spte);
 			update[i].val = *spte & ~INTEL_PTE_WRITE;
@@ -1827,7 +2302,8 @@ void pmap_protect(
 	    s = l;
 	    pde++;
 	}
-	PMAP_UPDATE_TLBS(map, _s, e);
+	if (changed)
+	    PMAP_UPDATE_TLBS(map, _s, e);
 
 	simple_unlock(&map->lock);
 	SPLX(spl);
@@ -1906,6 +2382,11 @@ if (pmap_debug) printf("pmap(%lx, %lx)\n", v, pa);
 Retry:
 	PMAP_READ_LOCK(pmap, spl);
 
+	/*
+	 *	Changing part of a superpage splits it.
+	 */
+	pmap_demote(pmap, v);
+
 	/*
 	 *	Expand pmap to include this pte.  Assume that
 	 *	pmap is always expanded to include enough hardware
@@ -1983,6 +2464,10 @@ Retry:
 	    continue;
 	}
 
+#ifndef	MACH_PV_PAGETABLES
+	pmap_wrprot_apply(pmap, v);
+#endif	/* MACH_PV_PAGETABLES */
+
 	if (vm_page_ready())
 		is_physmem = (vm_page_lookup_pa(pa) != NULL);
 	else
@@ -2013,6 +2498,9 @@ Retry:
 		template |= INTEL_PTE_NCACHE|INTEL_PTE_WTHRU;
 	    if (wired)
 		template |= INTEL_PTE_WIRED;
+	    if (pmap == kernel_pmap
+		&& CPU_HAS_FEATURE(CPU_FEATURE_PGE))
+		template |= INTEL_PTE_GLOBAL;
 	    i = ptes_per_vm_page;
 	    do {
 		if (*pte & INTEL_PTE_MOD)
@@ -2125,6 +2613,9 @@ Retry:
 		template |= INTEL_PTE_NCACHE|INTEL_PTE_WTHRU;
 	    if (wired)
 		template |= INTEL_PTE_WIRED;
+	    if (pmap == kernel_pmap
+		&& CPU_HAS_FEATURE(CPU_FEATURE_PGE))
+		template |= INTEL_PTE_GLOBAL;
 	    i = ptes_per_vm_page;
 	    do {
 #ifdef	MACH_PV_PAGETABLES
@@ -2143,6 +2634,18 @@ Retry:
 	}
 
 	PMAP_READ_UNLOCK(pmap, spl);
+
+	/*
+	 *	Try to promote the block to a superpage when entering
+	 *	its first or last page, which is when a block filled in
+	 *	address order becomes complete.
+	 */
+	if (pmap_superpages_enabled && pmap != kernel_pmap
+	    && (((v & (PDE_MAPPED_SIZE - 1)) == 0
+		 && (pa & (PDE_MAPPED_SIZE - 1)) == 0)
+		|| (((v + PAGE_SIZE) & (PDE_MAPPED_SIZE - 1)) == 0
+		    && ((pa + PAGE_SIZE) & (PDE_MAPPED_SIZE - 1)) == 0)))
+		pmap_promote(pmap, v);
 }
 
 /*
@@ -2167,6 +2670,7 @@ void pmap_change_wiring(
 	 */
 	PMAP_READ_LOCK(map, spl);
 
+	pmap_demote(map, v);
 	if ((pte = pmap_pte(map, v)) == PT_ENTRY_NULL)
 		panic("pmap_change_wiring: pte missing");
 
@@ -2273,6 +2777,13 @@ void pmap_collect(pmap_t p)
 	if (p == kernel_pmap)
 		return;
 
+#if	NCPUS > 1
+	/*
+	 *	Page table pages are about to be freed.
+	 */
+	pmap_lazy_release(p);
+#endif	/* NCPUS > 1 */
+
 #if PAE
 	for (i = 0; i <= lin2pdpnum(LINEAR_MIN_KERNEL_ADDRESS); i++) {
 	    free_all = i < lin2pdpnum(LINEAR_MIN_KERNEL_ADDRESS);
@@ -2292,7 +2803,7 @@ void pmap_collect(pmap_t p)
 		  || pdp < &page_dir[lin2pdenum(LINEAR_MIN_KERNEL_ADDRESS)])
 		     && pdp < &page_dir[NPTES];
 		 pdp += ptes_per_vm_page) {
-		if (*pdp & INTEL_PTE_VALID) {
+		if ((*pdp & INTEL_PTE_VALID) && !(*pdp & INTEL_PTE_PS)) {
 
 		    pa = pte_to_pa(*pdp);
 		    ptp = (pt_entry_t *)phystokv(pa);
@@ -2542,6 +3053,7 @@ phys_attribute_clear(
 		simple_lock(&pmap->lock);
 
 		va = pv_e->va;
+		pmap_demote(pmap, va);
 		pte = pmap_pte(pmap, va);
 
 		/*
@@ -2631,6 +3143,7 @@ phys_attribute_test(
 
 		{
 		    vm_offset_t va;
+		    pt_entry_t pde;
 
 		    va = pv_e->va;
 		    pte = pmap_pte(pmap, va);
@@ -2640,6 +3153,17 @@ phys_attribute_test(
 		     */
 		    assert(*pte & INTEL_PTE_VALID);
 		    assert(pte_to_pa(*pte) == phys);
+
+		    /*
+		     * The MMU sets the bits of a superpage in its
+		     * page directory entry.
+		     */
+		    pde = *pmap_pde(pmap, va);
+		    if (pmap_pde_superpage(pde) && (pde & bits)) {
+			simple_unlock(&pmap->lock);
+			PMAP_WRITE_UNLOCK(spl);
+			return (TRUE);
+		    }
 		}
 
 		/*
@@ -2768,6 +3292,55 @@ boolean_t pmap_is_referenced(phys_addr_t phys)
 * will result.
 */
 
+/*
+ *	Queue an update request for a CPU, without signaling it.
+ */
+static void pmap_queue_update(
+	int		which_cpu,
+	pmap_t		pmap,
+	vm_offset_t	start,
+	vm_offset_t	end)
+{
+	int			j;
+	pmap_update_list_t	update_list_p;
+
+	update_list_p = &cpu_update_list[which_cpu];
+	simple_lock(&update_list_p->lock);
+
+	/*
+	 *	Merge with a pending update of the same pmap.
+	 */
+	for (j = 0; j < update_list_p->count; j++) {
+	    if (update_list_p->item[j].pmap == pmap) {
+		if (start < update_list_p->item[j].start)
+		    update_list_p->item[j].start = start;
+		if (end > update_list_p->item[j].end)
+		    update_list_p->item[j].end = end;
+		break;
+	    }
+	}
+
+	if (j < update_list_p->count)
+	    ;
+	else if (j >= UPDATE_LIST_SIZE) {
+	    /*
+	     *	list overflowed.  Change last item to
+	     *	indicate overflow.
+	     */
+	    update_list_p->item[UPDATE_LIST_SIZE-1].pmap  = kernel_pmap;
+	    update_list_p->item[UPDATE_LIST_SIZE-1].start = VM_MIN_ADDRESS;
+	    update_list_p->item[UPDATE_LIST_SIZE-1].end   = VM_MAX_KERNEL_ADDRESS;
+	}
+	else {
+	    update_list_p->item[j].pmap  = pmap;
+	    update_list_p->item[j].start = start;
+	    update_list_p->item[j].end   = end;
+	    update_list_p->count = j+1;
+	}
+	cpu_update_needed[which_cpu] = TRUE;
+	simple_unlock(&update_list_p->lock);
+}
+
 /*
  *	Signal another CPU that it must flush its TLB
  */
@@ -2777,37 +3350,155 @@ void    signal_cpus(
 	vm_offset_t	start, 
 	vm_offset_t	end)
 {
-	int			which_cpu, j;
-	pmap_update_list_t	update_list_p;
+	int			which_cpu;
 
 	while ((which_cpu = ffs(use_list)) != 0) {
 	    which_cpu -= 1;	/* convert to 0 origin */
 
-	    update_list_p = &cpu_update_list[which_cpu];
-	    simple_lock(&update_list_p->lock);
+	    pmap_queue_update(which_cpu, pmap, start, end);
 
-	    j = update_list_p->count;
-	    if (j >= UPDATE_LIST_SIZE) {
-		/*
-		 *	list overflowed.  Change last item to
-		 *	indicate overflow.
-		 */
-		update_list_p->item[UPDATE_LIST_SIZE-1].pmap  = kernel_pmap;
-		update_list_p->item[UPDATE_LIST_SIZE-1].start = VM_MIN_ADDRESS;
-		update_list_p->item[UPDATE_LIST_SIZE-1].end   = VM_MAX_KERNEL_ADDRESS;
+	    if ((cpus_idle & (1 << which_cpu)) == 0)
+		interrupt_processor(which_cpu);
+	    use_list &= ~(1 << which_cpu);
+	}
+}
+
+/*
+ *	Routine:	pmap_batch_begin
+ *	Function:
+ *		Start gathering the TLB shootdowns of user pmaps
+ *		on this processor.  Batches nest.
+ *	Conditions:
+ *		The caller must not block until pmap_batch_end.
+ */
+void pmap_batch_begin(void)
+{
+	pmap_batch[cpu_number()].depth++;
+}
+
+/*
+ *	Queue updates for the CPUs of the current batch;
+ *	they are signaled by pmap_batch_end.
+ */
+static void pmap_batch_defer(
+	cpu_set		use_list,
+	pmap_t		pmap,
+	vm_offset_t	start,
+	vm_offset_t	end)
+{
+	struct pmap_batch	*batch = &pmap_batch[cpu_number()];
+	int			which_cpu;
+
+	batch->cpus |= use_list;
+	while ((which_cpu = ffs(use_list)) != 0) {
+	    which_cpu -= 1;	/* convert to 0 origin */
+
+	    pmap_queue_update(which_cpu, pmap, start, end);
+	    use_list &= ~(1 << which_cpu);
+	}
+}
+
+/*
+ *	Routine:	pmap_batch_end
+ *	Function:
+ *		End a batch started by pmap_batch_begin.  Leaving
+ *		the outermost batch signals each CPU with deferred
+ *		updates once, and waits for them to be processed.
+ */
+void pmap_batch_end(void)
+{
+	struct pmap_batch	*batch;
+	cpu_set			cpus, users;
+	int			which_cpu, spl;
+
+	SPLVM(spl);
+	batch = &pmap_batch[cpu_number()];
+	assert(batch->depth > 0);
+	if (--batch->depth == 0 && batch->cpus != 0) {
+	    cpus = users = batch->cpus;
+	    batch->cpus = 0;
+
+	    while ((which_cpu = ffs(users)) != 0) {
+		which_cpu -= 1;	/* convert to 0 origin */
+
+		if ((cpus_idle & (1 << which_cpu)) == 0)
+		    interrupt_processor(which_cpu);
+		users &= ~(1 << which_cpu);
 	    }
-	    else {
-		update_list_p->item[j].pmap  = pmap;
-		update_list_p->item[j].start = start;
-		update_list_p->item[j].end   = end;
-		update_list_p->count = j+1;
+
+	    /*
+	     *	As with PMAP_UPDATE_TLBS, cpus not in the active set
+	     *	don't touch user memory until they have processed
+	     *	their updates.
+	     */
+	    while ((which_cpu = ffs(cpus)) != 0) {
+		which_cpu -= 1;	/* convert to 0 origin */
+
+		while (cpu_update_needed[which_cpu]
+		       && (cpus_active & (1 << which_cpu)))
+		    continue;
+		cpus &= ~(1 << which_cpu);
 	    }
-	    cpu_update_needed[which_cpu] = TRUE;
-	    simple_unlock(&update_list_p->lock);
+	}
+	SPLX(spl);
+}
 
-	    if ((cpus_idle & (1 << which_cpu)) == 0)
+/*
+ *	Switch this CPU from the user page tables it keeps loaded
+ *	in lazy mode to those of the kernel.
+ */
+static void pmap_lazy_unload(int my_cpu)
+{
+	pmap_t	pmap = cpu_lazy_pmap[my_cpu];
+
+	set_pmap(kernel_pmap);
+	i_bit_clear(my_cpu, &pmap->cpus_lazy);
+	cpu_lazy_pmap[my_cpu] = PMAP_NULL;
+}
+
+/*
+ *	Routine:	pmap_lazy_release
+ *	Function:
+ *		Have all CPUs keeping the page tables of the pmap
+ *		loaded in lazy mode switch to those of the kernel,
+ *		before they are freed.
+ *	Conditions:
+ *		The pmap is no longer in use.  No pmap locked.
+ */
+static void pmap_lazy_release(pmap_t pmap)
+{
+	int	my_cpu, which_cpu, spl;
+
+	SPLVM(spl);
+	my_cpu = cpu_number();
+	if (cpu_lazy_pmap[my_cpu] == pmap)
+	    pmap_lazy_unload(my_cpu);
+	SPLX(spl);
+
+	for (which_cpu = 0; which_cpu < NCPUS; which_cpu++) {
+	    if (cpu_lazy_pmap[which_cpu] != pmap)
+		continue;
+
+	    /*
+	     *	An update of a pmap loaded in lazy mode unloads it.
+	     *	Idle cpus are signaled as well; they don't process
+	     *	updates, but do unload.
+	     */
+	    SPLVM(spl);
+	    signal_cpus(1 << which_cpu, pmap, VM_MIN_ADDRESS,
+			VM_MAX_ADDRESS);
+	    if (cpus_idle & (1 << which_cpu))
 		interrupt_processor(which_cpu);
-	    use_list &= ~(1 << which_cpu);
+	    SPLX(spl);
+
+	    /*
+	     *	Wait back in the active set, with interrupts
+	     *	enabled, so that this cpu processes the updates
+	     *	of others meanwhile: that cpu may well be waiting
+	     *	for this one to unload a pmap it releases.
+	     */
+	    while (cpu_lazy_pmap[which_cpu] == pmap)
+		continue;
 	}
 }
 
@@ -2817,6 +3508,7 @@ void process_pmap_updates(pmap_t my_pmap)
 	pmap_update_list_t	update_list_p;
 	int			j;
 	pmap_t			pmap;
+	boolean_t		unload = FALSE;
 
 	update_list_p = &cpu_update_list[my_cpu];
 	simple_lock(&update_list_p->lock);
@@ -2830,10 +3522,20 @@ void process_pmap_updates(pmap_t my_pmap)
 				update_list_p->item[j].start,
 				update_list_p->item[j].end);
 	    }
+	    else if (pmap == cpu_lazy_pmap[my_cpu])
+		unload = TRUE;
 	}
 	update_list_p->count = 0;
 	cpu_update_needed[my_cpu] = FALSE;
 	simple_unlock(&update_list_p->lock);
+
+	/*
+	 *	An update for the pmap loaded in lazy mode was queued
+	 *	before this cpu left its users.  Rather than flushing,
+	 *	stop keeping it loaded.
+	 */
+	if (unload)
+	    pmap_lazy_unload(my_cpu);
 }
 
 /*
@@ -2853,8 +3555,14 @@ void pmap_update_interrupt(void)
 	 *	the active set because we'll never process the interrupt
 	 *	while we're idle (thus hanging the system).
 	 */
-	if (cpus_idle & (1 << my_cpu))
+	if (cpus_idle & (1 << my_cpu)) {
+	    /*
+	     *	Only pmap_lazy_release interrupts idle cpus.
+	     */
+	    if (cpu_lazy_pmap[my_cpu] != PMAP_NULL)
+		pmap_lazy_unload(my_cpu);
 	    return;
+	}
 
 	if (current_thread() == THREAD_NULL)
 	    my_pmap = kernel_pmap;
@@ -38,6 +38,7 @@
 #ifndef	__ASSEMBLER__
 
 #include <kern/lock.h>
+#include <kern/queue.h>
 #include <mach/machine/vm_param.h>
 #include <mach/vm_statistics.h>
 #include <mach/kern_return.h>
@@ -131,6 +132,7 @@ typedef phys_addr_t pt_entry_t;
 #define INTEL_PTE_NCACHE 	0x00000010
 #define INTEL_PTE_REF		0x00000020
 #define INTEL_PTE_MOD		0x00000040
+#define INTEL_PTE_PS		0x00000080	/* superpage (in a pde) */
 #ifdef	MACH_PV_PAGETABLES
 /* Not supported */
 #define INTEL_PTE_GLOBAL	0x00000000
@@ -138,6 +140,8 @@ typedef phys_addr_t pt_entry_t;
 #define INTEL_PTE_GLOBAL	0x00000100
 #endif	/* MACH_PV_PAGETABLES */
 #define INTEL_PTE_WIRED		0x00000200
+#define INTEL_PTE_WRPROT	0x00000400	/* page table write-protected
+						   from its pde, see pmap.c */
 #ifdef PAE
 #define INTEL_PTE_PFN		0x00007ffffffff000ULL
 #else
@@ -172,6 +176,12 @@ struct pmap {
 					/* lock on map */
 	struct pmap_statistics	stats;	/* map statistics */
 	cpu_set		cpus_using;	/* bitmap of cpus using pmap */
+	cpu_set		cpus_lazy;	/* cpus which keep the pmap loaded
+					   with a valid TLB, while running
+					   kernel threads */
+	pt_entry_t	*superpage_pdes;	/* page directory entries
+						   replaced by superpages */
+	queue_chain_t	list;		/* link in pmap_list */
 };
 
 typedef struct pmap	*pmap_t;
@@ -223,6 +233,12 @@ cpu_set		cpus_idle;
 volatile
 boolean_t	cpu_update_needed[NCPUS];
 
+/*
+ *	User pmap whose page tables each cpu keeps loaded while
+ *	running kernel threads (lazy TLB mode), or PMAP_NULL.
+ */
+extern volatile pmap_t	cpu_lazy_pmap[NCPUS];
+
 /*
  *	External declarations for PMAP_ACTIVATE.
  */
@@ -231,6 +247,16 @@ void		process_pmap_updates(pmap_t);
 void		pmap_update_interrupt(void);
 extern	pmap_t	kernel_pmap;
 
+/*
+ *	Gathering of TLB shootdowns, see vm/pmap.h.
+ */
+
+extern void	pmap_batch_begin(void);
+extern void	pmap_batch_end(void);
+
+#define	PMAP_BATCH_BEGIN()	pmap_batch_begin()
+#define	PMAP_BATCH_END()	pmap_batch_end()
+
 #endif	/* NCPUS > 1 */
 
 /*
@@ -296,11 +322,17 @@ pt_entry_t *pmap_pte(const pmap_t pmap, vm_offset_t addr);
 									\
 	if (tpmap == kernel_pmap) {					\
 	    /*								\
-	     *	If this is the kernel pmap, switch to its page tables.	\
+	     *	If this is the kernel pmap, switch to its page tables,	\
+	     *	unless this cpu still has user page tables loaded.	\
+	     *	These map the kernel as well, and keeping them		\
+	     *	spares a TLB flush when switching back to the task.	\
 	     */								\
-	    set_pmap(tpmap);						\
+	    if (cpu_lazy_pmap[(my_cpu)] == PMAP_NULL)			\
+		set_pmap(tpmap);					\
 	}								\
 	else {								\
+	    pmap_t	lpmap = cpu_lazy_pmap[(my_cpu)];		\
+									\
 	    /*								\
 	     *	Let pmap updates proceed while we wait for this pmap.	\
 	     */								\
@@ -314,9 +346,17 @@ pt_entry_t *pmap_pte(const pmap_t pmap, vm_offset_t addr);
 									\
 	    /*								\
 	     *	No need to invalidate the TLB - the entire user pmap	\
-	     *	will be invalidated by reloading dirbase.		\
+	     *	will be invalidated by reloading dirbase.  Nor to	\
+	     *	reload it, if the pmap stayed loaded and no update	\
+	     *	was skipped for this cpu meanwhile.			\
 	     */								\
-	    set_pmap(tpmap);						\
+	    if (lpmap != tpmap						\
+		|| (tpmap->cpus_lazy & (1 << (my_cpu))) == 0)		\
+		set_pmap(tpmap);					\
+	    if (lpmap != PMAP_NULL) {					\
+		i_bit_clear((my_cpu), &lpmap->cpus_lazy);		\
+		cpu_lazy_pmap[(my_cpu)] = PMAP_NULL;			\
+	    }								\
 									\
 	    /*								\
 	     *	Mark that this cpu is using the pmap.			\
@@ -340,6 +380,16 @@ pt_entry_t *pmap_pte(const pmap_t pmap, vm_offset_t addr);
 	 *	Do nothing if this is the kernel pmap.			\
 	 */								\
 	if (tpmap != kernel_pmap) {					\
+	    /*								\
+	     *	Keep the pmap loaded in lazy mode.  Updates to the	\
+	     *	pmap no longer interrupt this cpu, but make it		\
+	     *	reload its TLB if it comes back to the pmap.  Enter	\
+	     *	the lazy set before leaving the users, so that no	\
+	     *	update misses this cpu.					\
+	     */								\
+	    cpu_lazy_pmap[(my_cpu)] = tpmap;				\
+	    i_bit_set((my_cpu), &tpmap->cpus_lazy);			\
+									\
 	    /*								\
 	     *	Mark pmap no longer in use by this cpu even if		\
 	     *	pmap is locked against updates.				\
@@ -449,6 +499,11 @@ extern void pmap_unmap_page_zero (void);
  */
 extern void pmap_zero_page (phys_addr_t);
 
+/*
+ *  pmap_zero_page_nocache zeros the specified page, bypassing the caches.
+ */
+extern void pmap_zero_page_nocache (phys_addr_t);
+
 /*
  *  pmap_copy_page copies the specified (machine independent) pages.
  */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef	_MACH_CHANNEL_H_
+#define	_MACH_CHANNEL_H_
+
+#include <mach/machine/vm_types.h>
+
+/*
+ *	A channel is a pair of byte rings in memory shared by the
+ *	tasks which map it.  It is created by channel_create, which
+ *	returns a port that can be passed to vm_map as a memory object;
+ *	every mapping of that port refers to the same memory.  The first
+ *	page of a channel holds the two ring headers, the data areas
+ *	follow it.  Ring CHANNEL_RING_FORWARD is meant to carry data
+ *	from the creator of the channel to its peer, and ring
+ *	CHANNEL_RING_BACKWARD the other way.
+ *
+ *	Each ring has a single producer and a single consumer.  The
+ *	producer owns cr_tail, the consumer owns cr_head; both are free
+ *	running byte counters, and the ring holds cr_tail - cr_head
+ *	bytes, starting at cr_head modulo cr_size in the data area.
+ *	Transfers need no kernel entry as long as neither side has to
+ *	wait.  A consumer finding the ring empty sets cr_consumer_waiting,
+ *	checks cr_tail again, and sleeps with gsync_wait (GSYNC_SHARED)
+ *	on cr_tail.  A producer that advances cr_tail and finds
+ *	cr_consumer_waiting set clears it and calls gsync_wake on cr_tail.
+ *	A full ring is handled the same way, with cr_producer_waiting
+ *	and cr_head.
+ */
+
+struct channel_ring {
+	volatile unsigned int	cr_head;	/* bytes consumed */
+	volatile unsigned int	cr_tail;	/* bytes produced */
+	volatile unsigned int	cr_consumer_waiting;
+	volatile unsigned int	cr_producer_waiting;
+	unsigned int		cr_size;	/* size of the data area,
+						   a power of two */
+	vm_offset_t		cr_data;	/* offset of the data area
+						   from the channel start */
+};
+
+#define	CHANNEL_RING_FORWARD	0
+#define	CHANNEL_RING_BACKWARD	1
+
+/*
+ *	Ring headers are kept on separate cache lines, so that both
+ *	directions don't share one.
+ */
+
+#define	CHANNEL_RING_ALIGN	64
+
+#define	CHANNEL_RING(channel, ring)					\
+		((struct channel_ring *)				\
+		 ((vm_offset_t) (channel) + (ring) * CHANNEL_RING_ALIGN))
+
+#endif	/* _MACH_CHANNEL_H_ */
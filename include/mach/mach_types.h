@@ -36,6 +36,7 @@
 #define _MACH_MACH_TYPES_H_
 
 #include <mach/host_info.h>
+#include <mach/kern_return.h>
 #include <mach/machine.h>
 #include <mach/machine/vm_types.h>
 #include <mach/memory_object.h>
@@ -56,6 +57,8 @@
 #include <mach/vm_wire.h>
 #include <mach/vm_sync.h>
 
+typedef	kern_return_t	*kern_return_array_t;
+
 #ifdef	MACH_KERNEL
 #include <kern/task.h>		/* for task_array_t */
 #include <kern/thread.h>	/* for thread_array_t */
@@ -298,9 +298,33 @@ typedef integer_t mach_msg_option_t;
 #define MACH_RCV_NOTIFY		0x00000200
 #define MACH_RCV_INTERRUPT	0x00000400	/* libmach implements */
 #define MACH_RCV_LARGE		0x00000800
+#define MACH_RCV_BATCH		0x00001000
 
 #define MACH_SEND_ALWAYS	0x00010000	/* internal use only */
 
+/*
+ *  With MACH_RCV_BATCH, the receive buffer starts with a
+ *  mach_msg_batch_header_t, followed by the received messages
+ *  laid out back to back.  The first message is received under the
+ *  usual rules (blocking, timeout, MACH_RCV_LARGE).  Further messages
+ *  are only dequeued if they are already queued and fit in the
+ *  remaining space of the buffer; the call never blocks for them.
+ *
+ *  On return, msgb_count holds the number of messages received and
+ *  msgb_size the number of bytes used in the buffer, including the
+ *  batch header.  If the first message can't be received, the batch
+ *  header is not written.  If copying out a later message fails, the
+ *  batch ends with that message and its error code is returned.
+ */
+
+typedef struct {
+    mach_msg_size_t	msgb_count;
+    mach_msg_size_t	msgb_size;
+} mach_msg_batch_header_t;
+
+#define	MACH_MSG_BATCH_FIRST(batch)				\
+		((mach_msg_header_t *) ((mach_msg_batch_header_t *) (batch) + 1))
+
 
 /*
  *  Much code assumes that mach_msg_return_t == kern_return_t.
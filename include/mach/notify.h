@@ -53,6 +53,8 @@
 			/* An extant send-once right died */
 #define MACH_NOTIFY_DEAD_NAME		(MACH_NOTIFY_FIRST + 010)
 			/* Send or send-once right died, leaving a dead-name */
+#define MACH_NOTIFY_DEAD_NAMES		(MACH_NOTIFY_FIRST + 011)
+			/* Several rights died, leaving dead-names */
 #define MACH_NOTIFY_LAST		(MACH_NOTIFY_FIRST + 015)
 
 typedef struct {
@@ -89,4 +91,20 @@ typedef struct {
     mach_port_t		not_port;
 } mach_dead_name_notification_t;
 
+/*
+ *  Dead-name notifications for a port on which batching was enabled
+ *  with mach_port_set_dead_name_batching may be coalesced into a
+ *  MACH_NOTIFY_DEAD_NAMES message.  It carries not_type.msgt_number
+ *  names, and msgh_size covers only those.  Each name stands for
+ *  one dead-name notification.
+ */
+
+#define MACH_NOTIFY_DEAD_NAMES_MAX	256
+
+typedef struct {
+    mach_msg_header_t	not_header;
+    mach_msg_type_t	not_type;	/* MACH_MSG_TYPE_PORT_NAME */
+    mach_port_t		not_ports[MACH_NOTIFY_DEAD_NAMES_MAX];
+} mach_dead_names_notification_t;
+
 #endif	/* _MACH_NOTIFY_H_ */
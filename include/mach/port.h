@@ -135,6 +135,16 @@ typedef struct mach_port_status {
 #define MACH_PORT_QLIMIT_DEFAULT	((mach_port_msgcount_t) 5)
 #define MACH_PORT_QLIMIT_MAX		((mach_port_msgcount_t) 16)
 
+/*
+ *  Flags for mach_port_set_queue_flags.
+ */
+
+#define MACH_PORT_QUEUE_PRIORITY	0x1	/* order queued messages by
+						   sender priority */
+#define MACH_PORT_QUEUE_INHERIT		0x2	/* receiver inherits the
+						   sender priority */
+#define MACH_PORT_QUEUE_FLAGS		0x3
+
 /*
  *  Compatibility definitions, for code written
  *  before there was an mps_seqno field.
@@ -74,4 +74,26 @@ typedef ipc_info_name_t *ipc_info_name_array_t;
 #define	IPC_INFO_TYPE_XMM_PAGER		11
 #define IPC_INFO_TYPE_PAGING_NAME	12
 
+/*
+ *	Message queue statistics of a port, see mach_port_get_stats.
+ *
+ *	Messages handed over by the mach_msg fast path never sit in
+ *	the queue; they are only counted in ipst_direct.  ipst_latency
+ *	is a histogram of the time messages spent queued: bucket 0
+ *	counts latencies under 2 microseconds, bucket N those in
+ *	[2^N, 2^(N+1)) microseconds, and the last bucket everything
+ *	longer.  The resolution is that of the kernel clock.
+ */
+
+#define	IPC_PORT_STATS_BUCKETS		24
+
+typedef struct ipc_port_stats {
+	natural_t ipst_enqueued;	/* messages accepted by the port */
+	natural_t ipst_dequeued;	/* messages received from the queue */
+	natural_t ipst_direct;		/* messages handed over directly */
+	natural_t ipst_sender_blocks;	/* senders blocked on the qlimit */
+	natural_t ipst_peak_depth;	/* highest message count */
+	natural_t ipst_latency[IPC_PORT_STATS_BUCKETS];
+} ipc_port_stats_t;
+
 #endif	/* _MACH_DEBUG_IPC_INFO_H_ */
@@ -128,4 +128,25 @@ typedef struct vm_page_info {
 
 typedef vm_page_info_t *vm_page_info_array_t;
 
+/*
+ *	Shadow chain statistics, see host_vm_shadow_info.
+ *
+ *	vsi_depth is a histogram of the number of shadow objects
+ *	page faults walked through before finding their page:
+ *	bucket N counts faults resolved N levels below the top
+ *	object, and the last bucket every deeper one.
+ */
+
+#define	VM_SHADOW_INFO_DEPTHS		16
+
+typedef struct vm_shadow_info {
+	natural_t vsi_queued;		/* objects queued for collapse */
+	natural_t vsi_deferred;		/* times a queued object was busy */
+	natural_t vsi_collapses;	/* backing objects collapsed */
+	natural_t vsi_bypasses;		/* backing objects bypassed */
+	natural_t vsi_background;	/* chains walked by the collapser */
+	natural_t vsi_depth_max;	/* deepest walk seen by a fault */
+	natural_t vsi_depth[VM_SHADOW_INFO_DEPTHS];
+} vm_shadow_info_t;
+
 #endif	/* _MACH_DEBUG_VM_INFO_H_ */
@@ -73,6 +73,7 @@
 	( ( ((vm_offset_t)(x)) + (sizeof(vm_offset_t)-1) ) & ~(sizeof(vm_offset_t)-1) )
 
 ipc_kmsg_t ipc_kmsg_cache[NCPUS];
+ipc_kmsg_t ipc_kmsg_reply_cache[NCPUS];
 
 /*
  *	Routine:	ipc_kmsg_enqueue
@@ -88,6 +89,44 @@ ipc_kmsg_enqueue(
 	ipc_kmsg_enqueue_macro(queue, kmsg);
 }
 
+/*
+ *	Routine:	ipc_kmsg_enqueue_priority
+ *	Purpose:
+ *		Enqueue a kmsg behind the messages with the same
+ *		or a higher priority, that is a lower ikm_priority,
+ *		and in front of the others.
+ */
+
+void
+ipc_kmsg_enqueue_priority(
+	ipc_kmsg_queue_t	queue,
+	ipc_kmsg_t		kmsg)
+{
+	ipc_kmsg_t first, next;
+
+	first = queue->ikmq_base;
+	if ((first == IKM_NULL) ||
+	    (first->ikm_prev->ikm_priority <= kmsg->ikm_priority)) {
+		ipc_kmsg_enqueue_macro(queue, kmsg);
+		return;
+	}
+
+	/* the last message has a lower priority, so this stops */
+
+	for (next = first;
+	     next->ikm_priority <= kmsg->ikm_priority;
+	     next = next->ikm_next)
+		continue;
+
+	kmsg->ikm_next = next;
+	kmsg->ikm_prev = next->ikm_prev;
+	next->ikm_prev->ikm_next = kmsg;
+	next->ikm_prev = kmsg;
+
+	if (next == first)
+		queue->ikmq_base = kmsg;
+}
+
 /*
  *	Routine:	ipc_kmsg_dequeue
  *	Purpose:
@@ -601,6 +640,9 @@ ipc_kmsg_put(
 	if ((kmsg->ikm_size == IKM_SAVED_KMSG_SIZE) &&
 	    (ikm_cache() == IKM_NULL))
 		ikm_cache() = kmsg;
+	else if ((kmsg->ikm_size == IKM_REPLY_KMSG_SIZE) &&
+		 (ikm_reply_cache() == IKM_NULL))
+		ikm_reply_cache() = kmsg;
 	else
 		ikm_free(kmsg);
 
@@ -36,6 +36,7 @@
 
 #include <mach/machine/vm_types.h>
 #include <mach/message.h>
+#include <mach/time_value.h>
 #include <kern/assert.h>
 #include <kern/cpu_number.h>
 #include <kern/macros.h>
@@ -61,6 +62,10 @@ typedef struct ipc_kmsg {
 	struct ipc_kmsg *ikm_next, *ikm_prev;
 	vm_size_t ikm_size;
 	ipc_marequest_t ikm_marequest;
+	int ikm_priority;		/* scheduling priority of the sender */
+#if	MACH_IPC_STATS
+	time_value_t ikm_stamp;		/* when the message was queued */
+#endif	/* MACH_IPC_STATS */
 	mach_msg_header_t ikm_header;
 } *ipc_kmsg_t;
 
@@ -113,6 +118,21 @@ extern ipc_kmsg_t	ipc_kmsg_cache[NCPUS];
 #define	IKM_SAVED_KMSG_SIZE	PAGE_SIZE
 #define	IKM_SAVED_MSG_SIZE	ikm_less_overhead(IKM_SAVED_KMSG_SIZE)
 
+/*
+ *	Replies to kernel calls are built by ipc_kobject_server in
+ *	buffers of IKM_REPLY_KMSG_SIZE bytes, large enough for any
+ *	kernel reply.  They get a per-processor cache of their own,
+ *	so that a kernel call doesn't go through kalloc and kfree
+ *	for its reply.
+ */
+
+extern ipc_kmsg_t	ipc_kmsg_reply_cache[NCPUS];
+
+#define ikm_reply_cache()	ipc_kmsg_reply_cache[cpu_number()]
+
+#define	IKM_REPLY_KMSG_SIZE	8192
+#define	IKM_REPLY_MSG_SIZE	ikm_less_overhead(IKM_REPLY_KMSG_SIZE)
+
 #define	ikm_alloc(size)							\
 		((ipc_kmsg_t) kalloc(ikm_plus_overhead(size)))
 
@@ -178,6 +198,11 @@ extern void ipc_kmsg_enqueue(
 	ipc_kmsg_queue_t	queue,
 	ipc_kmsg_t		kmsg);
 
+/* Enqueue a kmsg by priority */
+extern void ipc_kmsg_enqueue_priority(
+	ipc_kmsg_queue_t	queue,
+	ipc_kmsg_t		kmsg);
+
 /* Dequeue and return a kmsg */
 extern ipc_kmsg_t ipc_kmsg_dequeue(
 	ipc_kmsg_queue_t        queue);
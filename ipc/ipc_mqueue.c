@@ -42,6 +42,9 @@
 #include <kern/sched_prim.h>
 #include <kern/ipc_sched.h>
 #include <kern/ipc_kobject.h>
+#include <kern/processor.h>
+#include <kern/thread.h>
+#include <machine/machspl.h>
 #include <ipc/ipc_mqueue.h>
 #include <ipc/ipc_thread.h>
 #include <ipc/ipc_kmsg.h>
@@ -72,8 +75,10 @@ ipc_mqueue_init(
  *	Purpose:
  *		Move messages from one queue (source) to another (dest).
  *		Only moves messages sent to the specified port.
+ *		Messages of a priority-ordered port are queued
+ *		by priority, as in ipc_mqueue_send.
  *	Conditions:
- *		Both queues must be locked.
+ *		The port and both queues must be locked.
  *		(This is sufficient to manipulate port->ip_seqno.)
  */
 
@@ -87,7 +92,9 @@ ipc_mqueue_move(
 	ipc_thread_queue_t blockedq;
 	ipc_kmsg_t kmsg, next;
 	ipc_thread_t th;
+	boolean_t prioq;
 
+	prioq = (port->ip_flags & IP_PRIOQ) != 0;
 	oldq = &source->imq_messages;
 	newq = &dest->imq_messages;
 	blockedq = &dest->imq_threads;
@@ -126,11 +133,44 @@ ipc_mqueue_move(
 
 		/* didn't find a receiver to handle the message */
 
-		ipc_kmsg_enqueue(newq, kmsg);
+		if (prioq)
+			ipc_kmsg_enqueue_priority(newq, kmsg);
+		else
+			ipc_kmsg_enqueue(newq, kmsg);
 	    next_kmsg:;
 	}
 }
 
+/*
+ *	Routine:	ipc_mqueue_unboost
+ *	Purpose:
+ *		Return a thread to the priority it had before
+ *		ipc_mqueue_receive raised it to the priority of
+ *		a message sender.  A depressed thread already runs
+ *		at the lowest priority, and recomputes its priority
+ *		when the depression ends.
+ *	Conditions:
+ *		The thread is the current thread.  No thread
+ *		locks held.
+ */
+
+void
+ipc_mqueue_unboost(
+	thread_t	thread)
+{
+	spl_t s;
+
+	s = splsched();
+	thread_lock(thread);
+	if (thread->boost_priority >= 0) {
+		if (thread->depress_priority < 0)
+			set_pri(thread, thread->boost_priority, FALSE);
+		thread->boost_priority = -1;
+	}
+	thread_unlock(thread);
+	splx(s);
+}
+
 /*
  *	Routine:	ipc_mqueue_changed
  *	Purpose:
@@ -152,6 +192,63 @@ ipc_mqueue_changed(
 	}
 }
 
+/*
+ *	Number of waiting receivers ipc_mqueue_receiver looks at.
+ */
+
+#define	IPC_MQUEUE_RECEIVER_SCAN	4
+
+/*
+ *	Routine:	ipc_mqueue_receiver
+ *	Purpose:
+ *		Choose the receiver to hand a message to, among
+ *		the threads waiting on a message queue.
+ *
+ *		The queue is a stack, so the first receivers are
+ *		those which ran most recently.  Among the first
+ *		few, prefer one which last ran on this processor,
+ *		where the message is cache-hot, or on an idle
+ *		processor, which can run it at once.  Otherwise,
+ *		keep to the first one, so that the other receivers
+ *		stay parked.
+ *	Conditions:
+ *		The message queue is locked.
+ */
+
+static ipc_thread_t
+ipc_mqueue_receiver(ipc_thread_queue_t receivers)
+{
+	ipc_thread_t first;
+#if	NCPUS > 1
+	processor_t myprocessor, processor;
+	ipc_thread_t thread;
+	int i;
+#endif	/* NCPUS > 1 */
+
+	first = ipc_thread_queue_first(receivers);
+
+#if	NCPUS > 1
+	if (first == ITH_NULL)
+		return ITH_NULL;
+
+	myprocessor = current_processor();
+	thread = first;
+	for (i = 0; i < IPC_MQUEUE_RECEIVER_SCAN; i++) {
+		processor = thread->last_processor;
+		if ((processor == myprocessor) ||
+		    ((processor != PROCESSOR_NULL) &&
+		     (processor->state == PROCESSOR_IDLE)))
+			return thread;
+
+		thread = thread->ith_next;
+		if (thread == first)
+			break;
+	}
+#endif	/* NCPUS > 1 */
+
+	return first;
+}
+
 /*
  *	Routine:	ipc_mqueue_send
  *	Purpose:
@@ -256,6 +353,7 @@ ipc_mqueue_send(
 
 		ipc_thread_enqueue(&port->ip_blocked, self);
 		self->ith_state = MACH_SEND_IN_PROGRESS;
+		ipc_port_stats_block(port);
 
 	 	ip_unlock(port);
 		counter(c_ipc_mqueue_send_block++);
@@ -315,9 +413,14 @@ ipc_mqueue_send(
 	ipc_pset_t pset;
 	ipc_thread_t receiver;
 	ipc_thread_queue_t receivers;
+	boolean_t prioq;
+
+	kmsg->ikm_priority = current_thread()->sched_pri;
+	prioq = (port->ip_flags & IP_PRIOQ) != 0;
 
 	port->ip_msgcount++;
 	assert(port->ip_msgcount > 0);
+	ipc_port_stats_enqueue(port, kmsg);
 
 	pset = port->ip_pset;
 	if (pset == IPS_NULL)
@@ -344,16 +447,21 @@ ipc_mqueue_send(
 	/* check for a receiver for the message */
 
 	for (;;) {
-		receiver = ipc_thread_queue_first(receivers);
+		receiver = ipc_mqueue_receiver(receivers);
 		if (receiver == ITH_NULL) {
 			/* no receivers; queue kmsg */
 
-			ipc_kmsg_enqueue_macro(&mqueue->imq_messages, kmsg);
+			if (prioq)
+				ipc_kmsg_enqueue_priority(
+					&mqueue->imq_messages, kmsg);
+			else
+				ipc_kmsg_enqueue_macro(
+					&mqueue->imq_messages, kmsg);
 			imq_unlock(mqueue);
 			break;
 		}
 
-		ipc_thread_rmqueue_first_macro(receivers, receiver);
+		ipc_thread_rmqueue(receivers, receiver);
 		assert(ipc_kmsg_queue_empty(&mqueue->imq_messages));
 
 		if (kmsg->ikm_header.msgh_size <= receiver->ith_msize) {
@@ -535,6 +643,11 @@ ipc_mqueue_receive(
 	if (resume)
 		goto after_thread_block;
 
+	/* a new receive ends the boost of the previous one */
+
+	if (self->boost_priority >= 0)
+		ipc_mqueue_unboost(self);
+
 	for (;;) {
 		kmsg = ipc_kmsg_queue_first(kmsgs);
 		if (kmsg != IKM_NULL) {
@@ -654,6 +767,7 @@ ipc_mqueue_receive(
 
     {
 	ipc_marequest_t marequest;
+	int priority = -1;
 
 	marequest = kmsg->ikm_marequest;
 	if (marequest != IMAR_NULL) {
@@ -671,6 +785,10 @@ ipc_mqueue_receive(
 
 		assert(port->ip_msgcount > 0);
 		port->ip_msgcount--;
+		ipc_port_stats_dequeue(port, kmsg);
+
+		if (port->ip_flags & IP_PRIOINHERIT)
+			priority = kmsg->ikm_priority;
 
 		senders = &port->ip_blocked;
 		sender = ipc_thread_queue_first(senders);
@@ -684,6 +802,27 @@ ipc_mqueue_receive(
 	}
 
 	ip_unlock(port);
+
+	/*
+	 *	Run at the sender's priority, if it is higher, until
+	 *	the next receive.  The priority to restore is saved in
+	 *	boost_priority, see ipc_mqueue_unboost.
+	 */
+
+	if (priority >= 0) {
+		thread_t self = current_thread();
+		spl_t s;
+
+		s = splsched();
+		thread_lock(self);
+		if (priority < self->sched_pri) {
+			if (self->boost_priority < 0)
+				self->boost_priority = self->sched_pri;
+			set_pri(self, priority, FALSE);
+		}
+		thread_unlock(self);
+		splx(s);
+	}
     }
 
 	current_task()->messages_received++;
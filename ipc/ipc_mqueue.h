@@ -61,6 +61,9 @@ ipc_mqueue_init(ipc_mqueue_t);
 extern void
 ipc_mqueue_move(ipc_mqueue_t, ipc_mqueue_t, ipc_port_t);
 
+extern void
+ipc_mqueue_unboost(thread_t);
+
 extern void
 ipc_mqueue_changed(ipc_mqueue_t, mach_msg_return_t);
 
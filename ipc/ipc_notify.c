@@ -36,6 +36,7 @@
 #include <mach/message.h>
 #include <mach/notify.h>
 #include <kern/assert.h>
+#include <kern/thread.h>
 #include <ipc/ipc_kmsg.h>
 #include <ipc/ipc_mqueue.h>
 #include <ipc/ipc_notify.h>
@@ -50,6 +51,9 @@ mach_no_senders_notification_t		ipc_notify_no_senders_template;
 mach_send_once_notification_t		ipc_notify_send_once_template;
 mach_dead_name_notification_t		ipc_notify_dead_name_template;
 
+static boolean_t ipc_notify_batch_dead_name(struct ipc_notify_batch *,
+					    ipc_port_t, mach_port_t);
+
 #define NOTIFY_MSGH_SEQNO	0
 
 /*
@@ -430,6 +434,12 @@ ipc_notify_dead_name(
 {
 	ipc_kmsg_t kmsg;
 	mach_dead_name_notification_t *n;
+	struct ipc_notify_batch *batch;
+
+	batch = current_thread()->ith_notify_batch;
+	if ((batch != NULL) &&
+	    ipc_notify_batch_dead_name(batch, port, name))
+		return;
 
 	kmsg = ikm_alloc(sizeof *n);
 	if (kmsg == IKM_NULL) {
@@ -447,3 +457,146 @@ ipc_notify_dead_name(
 
 	ipc_mqueue_send_always(kmsg);
 }
+
+/*
+ *	Routine:	ipc_notify_batch_send
+ *	Purpose:
+ *		Send a batch of dead-name notifications.  A batch
+ *		holding a single name is sent as a plain dead-name
+ *		notification, which has the same layout.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+static void
+ipc_notify_batch_send(ipc_kmsg_t kmsg)
+{
+	mach_dead_names_notification_t *n;
+	unsigned int count;
+
+	n = (mach_dead_names_notification_t *) &kmsg->ikm_header;
+	count = n->not_type.msgt_number;
+	assert((count > 0) && (count <= MACH_NOTIFY_DEAD_NAMES_MAX));
+
+	n->not_header.msgh_size = sizeof n->not_header + sizeof n->not_type
+		+ count * sizeof n->not_ports[0];
+	if (count == 1)
+		n->not_header.msgh_id = MACH_NOTIFY_DEAD_NAME;
+
+	ipc_mqueue_send_always(kmsg);
+}
+
+/*
+ *	Routine:	ipc_notify_batch_dead_name
+ *	Purpose:
+ *		Add a dead-name notification to a batch, if the
+ *		port it is sent to has batching enabled.  Returns
+ *		FALSE if the notification must be sent on its own.
+ *	Conditions:
+ *		Nothing locked.
+ *		Consumes a ref/soright for port if successful.
+ */
+
+static boolean_t
+ipc_notify_batch_dead_name(
+	struct ipc_notify_batch	*batch,
+	ipc_port_t		port,
+	mach_port_t		name)
+{
+	mach_dead_names_notification_t *n;
+	ipc_kmsg_t kmsg;
+	unsigned int i;
+
+	ip_lock(port);
+	if (!ip_active(port) || ((port->ip_flags & IP_DNBATCH) == 0)) {
+		ip_unlock(port);
+		return FALSE;
+	}
+	ip_unlock(port);
+
+	for (i = 0; i < batch->inb_count; i++) {
+		kmsg = batch->inb_kmsgs[i];
+		if (kmsg->ikm_header.msgh_remote_port != (mach_port_t) port)
+			continue;
+
+		n = (mach_dead_names_notification_t *) &kmsg->ikm_header;
+		n->not_ports[n->not_type.msgt_number++] = name;
+
+		/*
+		 *	The message already carries a send-once right
+		 *	for the port, so the one for this notification
+		 *	is dropped.
+		 */
+
+		ipc_port_release_sonce(port);
+
+		if (n->not_type.msgt_number == MACH_NOTIFY_DEAD_NAMES_MAX) {
+			batch->inb_kmsgs[i] =
+				batch->inb_kmsgs[--batch->inb_count];
+			ipc_notify_batch_send(kmsg);
+		}
+		return TRUE;
+	}
+
+	kmsg = ikm_alloc(sizeof *n);
+	if (kmsg == IKM_NULL)
+		return FALSE;
+
+	ikm_init(kmsg, sizeof *n);
+	n = (mach_dead_names_notification_t *) &kmsg->ikm_header;
+	n->not_header = ipc_notify_dead_name_template.not_header;
+	n->not_header.msgh_id = MACH_NOTIFY_DEAD_NAMES;
+	n->not_header.msgh_remote_port = (mach_port_t) port;
+	n->not_type = ipc_notify_dead_name_template.not_type;
+	n->not_type.msgt_number = 1;
+	n->not_ports[0] = name;
+
+	if (batch->inb_count == IPC_NOTIFY_BATCH_PORTS)
+		ipc_notify_batch_send(batch->inb_kmsgs[--batch->inb_count]);
+
+	batch->inb_kmsgs[batch->inb_count++] = kmsg;
+	return TRUE;
+}
+
+/*
+ *	Routine:	ipc_notify_batch_begin
+ *	Purpose:
+ *		Start collecting the dead-name notifications
+ *		generated by the current thread in a batch.
+ *		Batches don't nest; an inner batch is ignored.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+void
+ipc_notify_batch_begin(struct ipc_notify_batch *batch)
+{
+	thread_t thread = current_thread();
+
+	batch->inb_count = 0;
+	if (thread->ith_notify_batch == NULL)
+		thread->ith_notify_batch = batch;
+}
+
+/*
+ *	Routine:	ipc_notify_batch_end
+ *	Purpose:
+ *		Send the notifications collected in a batch.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+void
+ipc_notify_batch_end(struct ipc_notify_batch *batch)
+{
+	thread_t thread = current_thread();
+
+	if (thread->ith_notify_batch != batch) {
+		assert(batch->inb_count == 0);
+		return;
+	}
+
+	thread->ith_notify_batch = NULL;
+	while (batch->inb_count > 0)
+		ipc_notify_batch_send(batch->inb_kmsgs[--batch->inb_count]);
+}
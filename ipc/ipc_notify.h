@@ -55,4 +55,23 @@ ipc_notify_send_once(ipc_port_t);
 extern void
 ipc_notify_dead_name(ipc_port_t, mach_port_t);
 
+/*
+ *	A notification batch collects the dead-name notifications
+ *	a thread generates for ports marked IP_DNBATCH, and sends
+ *	them as one message per port when it ends.
+ */
+
+#define	IPC_NOTIFY_BATCH_PORTS	16
+
+struct ipc_notify_batch {
+	unsigned int		inb_count;
+	struct ipc_kmsg		*inb_kmsgs[IPC_NOTIFY_BATCH_PORTS];
+};
+
+extern void
+ipc_notify_batch_begin(struct ipc_notify_batch *);
+
+extern void
+ipc_notify_batch_end(struct ipc_notify_batch *);
+
 #endif	/* _IPC_IPC_NOTIFY_H_ */
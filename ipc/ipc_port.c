@@ -42,7 +42,10 @@
 #include <kern/lock.h>
 #include <kern/ipc_sched.h>
 #include <kern/ipc_kobject.h>
+#include <kern/log2.h>
+#include <kern/mach_clock.h>
 #include <ipc/ipc_entry.h>
+#include <ipc/ipc_kmsg.h>
 #include <ipc/ipc_space.h>
 #include <ipc/ipc_object.h>
 #include <ipc/ipc_port.h>
@@ -531,6 +534,10 @@ ipc_port_init(
 	port->ip_qlimit = MACH_PORT_QLIMIT_DEFAULT;
 	ipc_port_flag_protected_payload_clear(port);
 	port->ip_protected_payload = 0;
+	port->ip_flags = 0;
+#if	MACH_IPC_STATS
+	memset(&port->ip_stats, 0, sizeof port->ip_stats);
+#endif	/* MACH_IPC_STATS */
 
 	ipc_mqueue_init(&port->ip_messages);
 	ipc_thread_queue_init(&port->ip_blocked);
@@ -1239,6 +1246,73 @@ ipc_port_dealloc_special(
 	ipc_port_destroy(port);
 }
 
+#if	MACH_IPC_STATS
+
+/*
+ *	Routine:	ipc_port_stats_enqueue
+ *	Purpose:
+ *		Account for a message queued on the port,
+ *		and stamp it with the time it was queued.
+ *	Conditions:
+ *		The port is locked, and ip_msgcount already
+ *		includes the message.
+ */
+
+void
+ipc_port_stats_enqueue(
+	ipc_port_t	port,
+	ipc_kmsg_t	kmsg)
+{
+	ipc_port_stats_t *stats = &port->ip_stats;
+
+	stats->ipst_enqueued++;
+	if (port->ip_msgcount > stats->ipst_peak_depth)
+		stats->ipst_peak_depth = port->ip_msgcount;
+
+	record_time_stamp(&kmsg->ikm_stamp);
+}
+
+/*
+ *	Routine:	ipc_port_stats_dequeue
+ *	Purpose:
+ *		Account for a message taken off the port's queue,
+ *		and record the time it spent queued in the
+ *		latency histogram.
+ *	Conditions:
+ *		The port is locked.
+ */
+
+void
+ipc_port_stats_dequeue(
+	ipc_port_t	port,
+	ipc_kmsg_t	kmsg)
+{
+	ipc_port_stats_t *stats = &port->ip_stats;
+	time_value_t latency;
+	unsigned long usecs;
+	unsigned int bucket;
+
+	stats->ipst_dequeued++;
+
+	record_time_stamp(&latency);
+	time_value_sub(&latency, &kmsg->ikm_stamp);
+
+	if (latency.seconds < 0)
+		usecs = 0;
+	else if (latency.seconds >= (1UL << (IPC_PORT_STATS_BUCKETS - 20)))
+		usecs = ~0UL;
+	else
+		usecs = latency.seconds * 1000000UL + latency.microseconds;
+
+	bucket = (usecs < 2) ? 0 : ilog2(usecs);
+	if (bucket >= IPC_PORT_STATS_BUCKETS)
+		bucket = IPC_PORT_STATS_BUCKETS - 1;
+
+	stats->ipst_latency[bucket]++;
+}
+
+#endif	/* MACH_IPC_STATS */
+
 #if	MACH_KDB
 #define	printf	kdbprintf
 
@@ -42,6 +42,7 @@
 #include <mach/boolean.h>
 #include <mach/kern_return.h>
 #include <mach/port.h>
+#include <mach_debug/ipc_info.h>
 #include <kern/lock.h>
 #include <kern/macros.h>
 #include <kern/ipc_kobject.h>
@@ -98,6 +99,10 @@ struct ipc_port {
 	mach_port_msgcount_t ip_qlimit;
 	struct ipc_thread_queue ip_blocked;
 	unsigned long ip_protected_payload;
+	unsigned int ip_flags;
+#if	MACH_IPC_STATS
+	ipc_port_stats_t ip_stats;		/* locked by port */
+#endif	/* MACH_IPC_STATS */
 };
 
 #define ip_object		ip_target.ipt_object
@@ -128,6 +133,15 @@ struct ipc_port {
 
 #define	ip_kotype(port)		io_kotype(&(port)->ip_object)
 
+/*
+ *	Values for ip_flags, which is protected by the port lock.
+ */
+
+#define	IP_DNBATCH	0x1	/* coalesce dead-name notifications
+				   sent to this port */
+#define	IP_PRIOQ	0x2	/* order messages by sender priority */
+#define	IP_PRIOINHERIT	0x4	/* receivers inherit sender priority */
+
 typedef ipc_table_index_t ipc_port_request_index_t;
 
 typedef struct ipc_port_request {
@@ -333,6 +347,26 @@ ipc_port_dealloc_special(ipc_port_t, ipc_space_t);
 #define	ipc_port_release(port)		\
 		ipc_object_release(&(port)->ip_object)
 
+/*
+ *	Message queue statistics.  The port must be locked.
+ */
+
+#if	MACH_IPC_STATS
+extern void
+ipc_port_stats_enqueue(ipc_port_t, struct ipc_kmsg *);
+
+extern void
+ipc_port_stats_dequeue(ipc_port_t, struct ipc_kmsg *);
+
+#define	ipc_port_stats_direct(port)	((port)->ip_stats.ipst_direct++)
+#define	ipc_port_stats_block(port)	((port)->ip_stats.ipst_sender_blocks++)
+#else	/* MACH_IPC_STATS */
+#define	ipc_port_stats_enqueue(port, kmsg)
+#define	ipc_port_stats_dequeue(port, kmsg)
+#define	ipc_port_stats_direct(port)
+#define	ipc_port_stats_block(port)
+#endif	/* MACH_IPC_STATS */
+
 static inline boolean_t
 ipc_port_flag_protected_payload(const struct ipc_port *port)
 {
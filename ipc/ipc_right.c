@@ -1182,6 +1182,80 @@ ipc_right_delta(
 	return KERN_UREFS_OVERFLOW;
 }
 
+/*
+ *	Routine:	ipc_right_delta_locked
+ *	Purpose:
+ *		Modifies the user-reference count for a send right
+ *		or dead name, if that can be done without releasing
+ *		the right, that is without generating notifications.
+ *		Returns TRUE if the count was modified.  Otherwise
+ *		nothing is changed, and the caller must use
+ *		ipc_right_delta, which also reports errors.
+ *	Conditions:
+ *		The space is write-locked and active, and stays so.
+ */
+
+boolean_t
+ipc_right_delta_locked(
+	ipc_space_t 		space,
+	ipc_entry_t 		entry,
+	mach_port_right_t 	right,
+	mach_port_delta_t 	delta)
+{
+	ipc_entry_bits_t bits = entry->ie_bits;
+	mach_port_urefs_t urefs = IE_BITS_UREFS(bits);
+	ipc_port_t port;
+
+	assert(space->is_active);
+
+	if (MACH_PORT_UREFS_UNDERFLOW(urefs, delta) ||
+	    ((urefs + delta) == 0))
+		return FALSE;
+
+	switch (right) {
+	    case MACH_PORT_RIGHT_DEAD_NAME:
+		if (IE_BITS_TYPE(bits) != MACH_PORT_TYPE_DEAD_NAME)
+			return FALSE;
+
+		if (MACH_PORT_UREFS_OVERFLOW(urefs, delta))
+			return FALSE;
+
+		entry->ie_bits = bits + delta;
+		return TRUE;
+
+	    case MACH_PORT_RIGHT_SEND:
+		if ((bits & MACH_PORT_TYPE_SEND) == 0)
+			return FALSE;
+
+		/* maximum urefs for send is MACH_PORT_UREFS_MAX-1 */
+
+		if (MACH_PORT_UREFS_OVERFLOW(urefs+1, delta))
+			return FALSE;
+
+		/*
+		 *	A send right for a dead port must turn into
+		 *	a dead name first, which ipc_right_delta does.
+		 */
+
+		port = (ipc_port_t) entry->ie_object;
+		assert(port != IP_NULL);
+
+		ip_lock(port);
+		if (!ip_active(port)) {
+			ip_unlock(port);
+			return FALSE;
+		}
+
+		assert(port->ip_srights > 0);
+		entry->ie_bits = bits + delta;
+		ip_unlock(port);
+		return TRUE;
+
+	    default:
+		return FALSE;
+	}
+}
+
 /*
  *	Routine:	ipc_right_info
  *	Purpose:
@@ -80,6 +80,10 @@ extern kern_return_t
 ipc_right_delta(ipc_space_t, mach_port_t, ipc_entry_t,
 		mach_port_right_t, mach_port_delta_t);
 
+extern boolean_t
+ipc_right_delta_locked(ipc_space_t, ipc_entry_t,
+		       mach_port_right_t, mach_port_delta_t);
+
 extern kern_return_t
 ipc_right_info(ipc_space_t, mach_port_t, ipc_entry_t,
 	       mach_port_type_t *, mach_port_urefs_t *);
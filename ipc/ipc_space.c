@@ -46,6 +46,7 @@
 #include <kern/slab.h>
 #include <ipc/port.h>
 #include <ipc/ipc_entry.h>
+#include <ipc/ipc_notify.h>
 #include <ipc/ipc_table.h>
 #include <ipc/ipc_port.h>
 #include <ipc/ipc_space.h>
@@ -173,6 +174,7 @@ void
 ipc_space_destroy(
 	ipc_space_t	space)
 {
+	struct ipc_notify_batch batch;
 	boolean_t active;
 
 	assert(space != IS_NULL);
@@ -185,6 +187,14 @@ ipc_space_destroy(
 	if (!active)
 		return;
 
+	/*
+	 *	Destroying the receive rights can generate many
+	 *	dead-name notifications; coalesce those for ports
+	 *	which asked for it.
+	 */
+
+	ipc_notify_batch_begin(&batch);
+
 	ipc_entry_t entry;
 	struct rdxtree_iter iter;
 	rdxtree_for_each(&space->is_map, &iter, entry) {
@@ -205,6 +215,8 @@ ipc_space_destroy(
 	rdxtree_remove_all(&space->is_map);
 	rdxtree_remove_all(&space->is_reverse_map);
 
+	ipc_notify_batch_end(&batch);
+
 	/*
 	 *	Because the space is now dead,
 	 *	we must release the "active" reference for it.
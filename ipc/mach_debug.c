@@ -286,3 +286,112 @@ mach_port_kernel_object(
 	ip_unlock(port);
 	return KERN_SUCCESS;
 }
+
+#if	MACH_IPC_STATS
+
+/*
+ *	Routine:	mach_port_stats_add
+ *	Purpose:
+ *		Add the statistics of a port to a running total.
+ *	Conditions:
+ *		The port is locked.
+ */
+
+static void
+mach_port_stats_add(
+	ipc_port_stats_t	*total,
+	const ipc_port_stats_t	*stats)
+{
+	int i;
+
+	total->ipst_enqueued += stats->ipst_enqueued;
+	total->ipst_dequeued += stats->ipst_dequeued;
+	total->ipst_direct += stats->ipst_direct;
+	total->ipst_sender_blocks += stats->ipst_sender_blocks;
+	if (stats->ipst_peak_depth > total->ipst_peak_depth)
+		total->ipst_peak_depth = stats->ipst_peak_depth;
+
+	for (i = 0; i < IPC_PORT_STATS_BUCKETS; i++)
+		total->ipst_latency[i] += stats->ipst_latency[i];
+}
+
+/*
+ *	Routine:	mach_port_get_stats [kernel call]
+ *	Purpose:
+ *		Retrieve the message queue statistics of a receive
+ *		right.  If the name is MACH_PORT_NULL, retrieve the
+ *		sum over all receive rights in the space, with the
+ *		largest peak depth among them.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Retrieved the statistics.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_TASK	The space is dead.
+ *		KERN_INVALID_NAME	The name doesn't denote a right.
+ *		KERN_INVALID_RIGHT	Name doesn't denote receive rights.
+ */
+
+kern_return_t
+mach_port_get_stats(
+	ipc_space_t		space,
+	mach_port_t		name,
+	ipc_port_stats_t	*statsp)
+{
+	ipc_entry_t entry;
+	ipc_port_t port;
+	kern_return_t kr;
+
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	memset(statsp, 0, sizeof *statsp);
+
+	if (name == MACH_PORT_NULL) {
+		struct rdxtree_iter iter;
+
+		is_read_lock(space);
+		if (!space->is_active) {
+			is_read_unlock(space);
+			return KERN_INVALID_TASK;
+		}
+
+		rdxtree_for_each(&space->is_map, &iter, entry) {
+			if ((entry->ie_bits & MACH_PORT_TYPE_RECEIVE) == 0)
+				continue;
+
+			port = (ipc_port_t) entry->ie_object;
+			assert(port != IP_NULL);
+
+			ip_lock(port);
+			if (ip_active(port))
+				mach_port_stats_add(statsp, &port->ip_stats);
+			ip_unlock(port);
+		}
+		is_read_unlock(space);
+		return KERN_SUCCESS;
+	}
+
+	kr = ipc_right_lookup_read(space, name, &entry);
+	if (kr != KERN_SUCCESS)
+		return kr;
+	/* space is read-locked and active */
+
+	if ((entry->ie_bits & MACH_PORT_TYPE_RECEIVE) == 0) {
+		is_read_unlock(space);
+		return KERN_INVALID_RIGHT;
+	}
+
+	port = (ipc_port_t) entry->ie_object;
+	assert(port != IP_NULL);
+
+	ip_lock(port);
+	is_read_unlock(space);
+	assert(ip_active(port));
+
+	*statsp = port->ip_stats;
+	ip_unlock(port);
+	return KERN_SUCCESS;
+}
+
+#endif	/* MACH_IPC_STATS */
@@ -47,6 +47,7 @@
 #include <kern/sched_prim.h>
 #include <kern/ipc_sched.h>
 #include <kern/exception.h>
+#include <kern/ipc_kobject.h>
 #include <vm/vm_map.h>
 #include <ipc/ipc_kmsg.h>
 #include <ipc/ipc_marequest.h>
@@ -148,6 +149,108 @@ mach_msg_send(
 	return mr;
 }
 
+/*
+ *	Routine:	mach_msg_receive_batch
+ *	Purpose:
+ *		Complete a MACH_RCV_BATCH receive.  The first message,
+ *		of first_size bytes, has already been copied out to msg,
+ *		right behind the batch header.  Dequeue further messages
+ *		which are already queued and fit in the remaining space,
+ *		copy them out behind the first one and fill in the
+ *		batch header.  Never blocks waiting for a message.
+ *	Conditions:
+ *		Nothing locked.  The caller holds a reference for object,
+ *		which is consumed.  notify has already been validated.
+ *	Returns:
+ *		MACH_MSG_SUCCESS	Filled in the batch.
+ *		MACH_RCV_INVALID_DATA	Couldn't copy to user buffer.
+ *		MACH_RCV_HEADER_ERROR, MACH_RCV_BODY_ERROR
+ *			Copyout of the last message in the batch failed.
+ */
+
+static mach_msg_return_t
+mach_msg_receive_batch(
+	mach_msg_header_t	*msg,
+	mach_msg_size_t		rcv_size,
+	mach_msg_size_t		first_size,
+	ipc_object_t		object,
+	ipc_mqueue_t		mqueue,
+	mach_port_t		notify)
+{
+	ipc_space_t space = current_space();
+	vm_map_t map = current_map();
+	mach_msg_batch_header_t batch;
+	mach_msg_size_t used = first_size;
+	mach_msg_return_t mr = MACH_MSG_SUCCESS;
+
+	batch.msgb_count = 1;
+
+	while (rcv_size - used >= sizeof(mach_msg_header_t)) {
+		mach_msg_header_t *next;
+		mach_msg_size_t size;
+		ipc_kmsg_t kmsg;
+		mach_port_seqno_t seqno;
+
+		/*
+		 *	As in ipc_mqueue_copyin, the object must be
+		 *	active when its message queue gets locked.
+		 */
+
+		io_lock(object);
+		if (!io_active(object)) {
+			io_unlock(object);
+			break;
+		}
+		imq_lock(mqueue);
+		io_unlock(object);
+
+		mr = ipc_mqueue_receive(mqueue, MACH_RCV_TIMEOUT,
+					rcv_size - used, 0,
+					FALSE, (void (*)(void)) 0,
+					&kmsg, &seqno);
+		/* mqueue is unlocked */
+		if (mr != MACH_MSG_SUCCESS) {
+			/*
+			 *	The queue is empty, or the next message
+			 *	doesn't fit and stays queued.
+			 */
+
+			mr = MACH_MSG_SUCCESS;
+			break;
+		}
+
+		kmsg->ikm_header.msgh_seqno = seqno;
+		next = (mach_msg_header_t *) ((vm_offset_t) msg + used);
+		size = kmsg->ikm_header.msgh_size;
+		batch.msgb_count++;
+
+		mr = ipc_kmsg_copyout(kmsg, space, map, notify);
+		if (mr != MACH_MSG_SUCCESS) {
+			if ((mr &~ MACH_MSG_MASK) != MACH_RCV_BODY_ERROR) {
+				ipc_kmsg_copyout_dest(kmsg, space);
+				size = sizeof *next;
+			}
+
+			(void) ipc_kmsg_put(next, kmsg, size);
+			used += size;
+			break;
+		}
+
+		mr = ipc_kmsg_put(next, kmsg, size);
+		used += size;
+		if (mr != MACH_MSG_SUCCESS)
+			break;
+	}
+
+	ipc_object_release(object);
+
+	batch.msgb_size = sizeof batch + used;
+	if (copyout(&batch, (mach_msg_batch_header_t *) msg - 1, sizeof batch))
+		return MACH_RCV_INVALID_DATA;
+
+	return mr;
+}
+
 /*
  *	Routine:	mach_msg_receive
  *	Purpose:
@@ -167,6 +270,9 @@ mach_msg_send(
  *		MACH_RCV_INVALID_DATA	Couldn't copy to user buffer.
  *		MACH_RCV_INVALID_NOTIFY	Bad notify port.
  *		MACH_RCV_HEADER_ERROR
+ *
+ *		With MACH_RCV_BATCH, msg and rcv_size describe the whole
+ *		batch buffer; see mach/message.h.
  */
 
 mach_msg_return_t
@@ -187,6 +293,17 @@ mach_msg_receive(
 	mach_port_seqno_t seqno;
 	mach_msg_return_t mr;
 
+	if (option & MACH_RCV_BATCH) {
+		if (rcv_size < sizeof(mach_msg_batch_header_t) +
+			       sizeof(mach_msg_header_t))
+			return MACH_RCV_INVALID_DATA;
+
+		/* receive the first message right behind the batch header */
+
+		msg = MACH_MSG_BATCH_FIRST(msg);
+		rcv_size -= sizeof(mach_msg_batch_header_t);
+	}
+
 	mr = ipc_mqueue_copyin(space, rcv_name, &mqueue, &object);
 	if (mr != MACH_MSG_SUCCESS)
 		return mr;
@@ -212,7 +329,8 @@ mach_msg_receive(
 					FALSE, mach_msg_receive_continue,
 					&kmsg, &seqno);
 		/* mqueue is unlocked */
-		ipc_object_release(object);
+		if ((mr != MACH_MSG_SUCCESS) || !(option & MACH_RCV_BATCH))
+			ipc_object_release(object);
 		if (mr != MACH_MSG_SUCCESS) {
 			if (mr == MACH_RCV_TOO_LARGE) {
 				mach_msg_size_t real_size =
@@ -236,12 +354,15 @@ mach_msg_receive(
 					FALSE, mach_msg_receive_continue,
 					&kmsg, &seqno);
 		/* mqueue is unlocked */
-		ipc_object_release(object);
+		if ((mr != MACH_MSG_SUCCESS) || !(option & MACH_RCV_BATCH))
+			ipc_object_release(object);
 		if (mr != MACH_MSG_SUCCESS)
 			return mr;
 
 		kmsg->ikm_header.msgh_seqno = seqno;
 		if (kmsg->ikm_header.msgh_size > rcv_size) {
+			if (option & MACH_RCV_BATCH)
+				ipc_object_release(object);
 			ipc_kmsg_copyout_dest(kmsg, space);
 			(void) ipc_kmsg_put(msg, kmsg, sizeof *msg);
 			return MACH_RCV_TOO_LARGE;
@@ -256,6 +377,8 @@ mach_msg_receive(
 	} else
 		mr = ipc_kmsg_copyout(kmsg, space, map, MACH_PORT_NULL);
 	if (mr != MACH_MSG_SUCCESS) {
+		if (option & MACH_RCV_BATCH)
+			ipc_object_release(object);
 		if ((mr &~ MACH_MSG_MASK) == MACH_RCV_BODY_ERROR) {
 			(void) ipc_kmsg_put(msg, kmsg,
 					    kmsg->ikm_header.msgh_size);
@@ -267,6 +390,21 @@ mach_msg_receive(
 		return mr;
 	}
 
+	if (option & MACH_RCV_BATCH) {
+		mach_msg_size_t size = kmsg->ikm_header.msgh_size;
+
+		mr = ipc_kmsg_put(msg, kmsg, size);
+		if (mr != MACH_MSG_SUCCESS) {
+			ipc_object_release(object);
+			return mr;
+		}
+
+		return mach_msg_receive_batch(msg, rcv_size, size,
+					      object, mqueue,
+					      (option & MACH_RCV_NOTIFY) ?
+					      notify : MACH_PORT_NULL);
+	}
+
 	return ipc_kmsg_put(msg, kmsg, kmsg->ikm_header.msgh_size);
 }
 
@@ -303,7 +441,8 @@ mach_msg_receive_continue(void)
 					TRUE, mach_msg_receive_continue,
 					&kmsg, &seqno);
 		/* mqueue is unlocked */
-		ipc_object_release(object);
+		if ((mr != MACH_MSG_SUCCESS) || !(option & MACH_RCV_BATCH))
+			ipc_object_release(object);
 		if (mr != MACH_MSG_SUCCESS) {
 			if (mr == MACH_RCV_TOO_LARGE) {
 				mach_msg_size_t real_size =
@@ -328,7 +467,8 @@ mach_msg_receive_continue(void)
 					TRUE, mach_msg_receive_continue,
 					&kmsg, &seqno);
 		/* mqueue is unlocked */
-		ipc_object_release(object);
+		if ((mr != MACH_MSG_SUCCESS) || !(option & MACH_RCV_BATCH))
+			ipc_object_release(object);
 		if (mr != MACH_MSG_SUCCESS) {
 			thread_syscall_return(mr);
 			/*NOTREACHED*/
@@ -336,6 +476,8 @@ mach_msg_receive_continue(void)
 
 		kmsg->ikm_header.msgh_seqno = seqno;
 		if (kmsg->ikm_header.msgh_size > rcv_size) {
+			if (option & MACH_RCV_BATCH)
+				ipc_object_release(object);
 			ipc_kmsg_copyout_dest(kmsg, space);
 			(void) ipc_kmsg_put(msg, kmsg, sizeof *msg);
 			thread_syscall_return(MACH_RCV_TOO_LARGE);
@@ -351,6 +493,8 @@ mach_msg_receive_continue(void)
 	} else
 		mr = ipc_kmsg_copyout(kmsg, space, map, MACH_PORT_NULL);
 	if (mr != MACH_MSG_SUCCESS) {
+		if (option & MACH_RCV_BATCH)
+			ipc_object_release(object);
 		if ((mr &~ MACH_MSG_MASK) == MACH_RCV_BODY_ERROR) {
 			(void) ipc_kmsg_put(msg, kmsg,
 					    kmsg->ikm_header.msgh_size);
@@ -363,6 +507,21 @@ mach_msg_receive_continue(void)
 		/*NOTREACHED*/
 	}
 
+	if (option & MACH_RCV_BATCH) {
+		mach_msg_size_t size = kmsg->ikm_header.msgh_size;
+
+		mr = ipc_kmsg_put(msg, kmsg, size);
+		if (mr != MACH_MSG_SUCCESS)
+			ipc_object_release(object);
+		else
+			mr = mach_msg_receive_batch(msg, rcv_size, size,
+						    object, mqueue,
+						    (option & MACH_RCV_NOTIFY) ?
+						    notify : MACH_PORT_NULL);
+		thread_syscall_return(mr);
+		/*NOTREACHED*/
+	}
+
 	mr = ipc_kmsg_put(msg, kmsg, kmsg->ikm_header.msgh_size);
 	thread_syscall_return(mr);
 	/*NOTREACHED*/
@@ -400,6 +559,13 @@ mach_msg_trap(
 		ipc_object_t rcv_object;
 		ipc_mqueue_t rcv_mqueue;
 		mach_msg_size_t reply_size;
+		mig_routine_t routine;
+		ipc_kmsg_t reply_kmsg;
+
+		/* a new receive ends the boost of the previous one */
+
+		if (self->boost_priority >= 0)
+			ipc_mqueue_unboost(self);
 
 		/*
 		 *	This case is divided into ten sections, each
@@ -538,6 +704,33 @@ mach_msg_trap(
 			}
 			is_read_unlock(space);
 
+			if ((dest_port->ip_receiver == ipc_space_kernel) &&
+			    ((routine = ipc_kobject_fast_routine(
+					&kmsg->ikm_header)) != 0) &&
+			    ((reply_kmsg = ikm_reply_cache()) != IKM_NULL)) {
+				/*
+				 *	Take references for kernel_call,
+				 *	but no rights.
+				 */
+				ikm_reply_cache() = IKM_NULL;
+				ikm_check_initialized(reply_kmsg,
+						      IKM_REPLY_KMSG_SIZE);
+
+				ip_reference(dest_port);
+				ip_reference(reply_port);
+				ip_unlock(reply_port);
+				ip_unlock(dest_port);
+
+				kmsg->ikm_header.msgh_bits =
+				    MACH_MSGH_BITS(MACH_MSG_TYPE_PORT_SEND,
+						   MACH_MSG_TYPE_PORT_SEND_ONCE);
+				kmsg->ikm_header.msgh_remote_port =
+						(mach_port_t) dest_port;
+				kmsg->ikm_header.msgh_local_port =
+						(mach_port_t) reply_port;
+				goto kernel_call;
+			}
+
 			assert(dest_port->ip_srights > 0);
 			dest_port->ip_srights++;
 			ip_reference(dest_port);
@@ -833,7 +1026,8 @@ mach_msg_trap(
 
 			if ((receiver->swap_func ==
 				(void (*)()) mach_msg_receive_continue) &&
-			    ((receiver->ith_option & MACH_RCV_NOTIFY) == 0)) {
+			    ((receiver->ith_option &
+			      (MACH_RCV_NOTIFY|MACH_RCV_BATCH)) == 0)) {
 				/*
 				 *	We can still use the optimized code.
 				 */
@@ -846,6 +1040,8 @@ mach_msg_trap(
 				 */
 
 				dest_port->ip_msgcount++;
+				ipc_port_stats_enqueue(dest_port, kmsg);
+				kmsg->ikm_priority = self->sched_pri;
 				ip_unlock(dest_port);
 
 				ipc_thread_enqueue_macro(
@@ -888,6 +1084,7 @@ mach_msg_trap(
 		 *	dest_port->ip_msgcount.
 		 */
 
+		ipc_port_stats_direct(dest_port);
 		ip_unlock(dest_port);
 
 		/*
@@ -1364,6 +1561,7 @@ mach_msg_trap(
 
 		dest_port = reply_port;
 		kmsg->ikm_header.msgh_seqno = dest_port->ip_seqno++;
+		ipc_port_stats_direct(dest_port);
 		imq_unlock(rcv_mqueue);
 
 		/*
@@ -1377,6 +1575,114 @@ mach_msg_trap(
 		goto fast_copyout;
 	    }
 
+	    kernel_call:
+		/*
+		 *	Special case: a kernel call run directly, see
+		 *	ipc_kobject_fast_routine.  The request message
+		 *	has been copied into the kmsg, which holds
+		 *	references but no rights for dest_port and the
+		 *	reply port.  We have a reply kmsg from the cache.
+		 *	Nothing is locked.
+		 *
+		 *	The server function decodes the request in place,
+		 *	and its reply is copied straight to the caller's
+		 *	buffer: no right is copied in for the request,
+		 *	no send-once right is made for the reply port,
+		 *	and the reply doesn't go through its queue.
+		 */
+
+	    {
+		ipc_port_t	reply_port;
+
+		counter(c_mach_msg_trap_kernel_call++);
+
+		reply_port = (ipc_port_t) kmsg->ikm_header.msgh_local_port;
+		ipc_kobject_fast_server(routine, kmsg, reply_kmsg);
+		kmsg = reply_kmsg;
+		ipc_port_release(dest_port);
+
+		/*
+		 *	The reply can be received directly under the
+		 *	same conditions as a reply from kernel_send,
+		 *	provided it fits the buffer and no payload has
+		 *	to be substituted for the name of the port.
+		 */
+
+		reply_size = kmsg->ikm_header.msgh_size;
+		ip_lock(reply_port);
+
+		if (ip_active(reply_port) &&
+		    (reply_port->ip_receiver == space) &&
+		    (reply_port->ip_receiver_name == rcv_name) &&
+		    (reply_port->ip_pset == IPS_NULL) &&
+		    !ipc_port_flag_protected_payload(reply_port) &&
+		    (reply_size <= rcv_size)) {
+			rcv_mqueue = &reply_port->ip_messages;
+			imq_lock(rcv_mqueue);
+
+			if ((ipc_thread_queue_first(&rcv_mqueue->imq_threads)
+				== ITH_NULL) &&
+			    (ipc_kmsg_queue_first(&rcv_mqueue->imq_messages)
+				== IKM_NULL)) {
+				kmsg->ikm_header.msgh_seqno =
+					reply_port->ip_seqno++;
+				ipc_port_stats_direct(reply_port);
+				imq_unlock(rcv_mqueue);
+
+				/* release the reference from fast_copyin */
+				ip_release(reply_port);
+				ip_check_unlock(reply_port);
+
+				kmsg->ikm_header.msgh_bits = MACH_MSGH_BITS(
+					0, MACH_MSG_TYPE_PORT_SEND_ONCE);
+				kmsg->ikm_header.msgh_remote_port =
+					MACH_PORT_NULL;
+				kmsg->ikm_header.msgh_local_port = rcv_name;
+
+				mr = MACH_MSG_SUCCESS;
+				if (copyoutmsg(&kmsg->ikm_header, msg,
+					       reply_size))
+					mr = MACH_RCV_INVALID_DATA;
+
+				if (ikm_reply_cache() == IKM_NULL)
+					ikm_reply_cache() = kmsg;
+				else
+					ikm_free(kmsg);
+
+				thread_syscall_return(mr);
+				/*NOTREACHED*/
+			}
+
+			imq_unlock(rcv_mqueue);
+		}
+
+		/*
+		 *	Send the reply as ipc_kobject_server would have,
+		 *	with a send-once right for the reply port, and
+		 *	receive it on the slow path.  If the port died,
+		 *	the reply is dropped, as it would have been.
+		 */
+
+		if (ip_active(reply_port)) {
+			reply_port->ip_sorights++;
+			ip_unlock(reply_port);
+
+			/* the reply takes the reference from fast_copyin */
+			kmsg->ikm_header.msgh_remote_port =
+				(mach_port_t) reply_port;
+			ipc_mqueue_send_always(kmsg);
+		} else {
+			ip_release(reply_port);
+			ip_check_unlock(reply_port);
+
+			if (ikm_reply_cache() == IKM_NULL)
+				ikm_reply_cache() = kmsg;
+			else
+				ikm_free(kmsg);
+		}
+		goto slow_get_rcv_port;
+	    }
+
 	    slow_send:
 		/*
 		 *	Nothing is locked.  We have acquired kmsg, but
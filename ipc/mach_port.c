@@ -733,6 +733,212 @@ mach_port_mod_refs(
 	return kr;
 }
 
+/*
+ *	Routine:	mach_port_allocate_array [kernel call]
+ *	Purpose:
+ *		Allocates count rights, like mach_port_allocate.
+ *		The name of each new right, or MACH_PORT_NULL,
+ *		is returned in names, and the code of each
+ *		allocation in results.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Attempted all allocations.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_VALUE	"right" isn't a legal value.
+ *		KERN_INVALID_VALUE	Too many rights requested.
+ */
+
+kern_return_t
+mach_port_allocate_array(
+	ipc_space_t		space,
+	mach_port_right_t	right,
+	natural_t		count,
+	mach_port_array_t	names,
+	mach_msg_type_number_t	*namesCnt,
+	kern_return_array_t	results,
+	mach_msg_type_number_t	*resultsCnt)
+{
+	natural_t i;
+
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	if ((right != MACH_PORT_RIGHT_RECEIVE) &&
+	    (right != MACH_PORT_RIGHT_PORT_SET) &&
+	    (right != MACH_PORT_RIGHT_DEAD_NAME))
+		return KERN_INVALID_VALUE;
+
+	if ((count > *namesCnt) || (count > *resultsCnt))
+		return KERN_INVALID_VALUE;
+
+	/*
+	 *	Each allocation takes the space lock on its own,
+	 *	since the objects have to be allocated first.
+	 */
+
+	for (i = 0; i < count; i++) {
+		results[i] = mach_port_allocate(space, right, &names[i]);
+		if (results[i] != KERN_SUCCESS)
+			names[i] = MACH_PORT_NULL;
+	}
+
+	*namesCnt = count;
+	*resultsCnt = count;
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	mach_port_delta_array
+ *	Purpose:
+ *		Common code for mach_port_deallocate_array and
+ *		mach_port_mod_refs_array.  If dealloc is TRUE,
+ *		releases a user reference for each name as
+ *		ipc_right_dealloc does, ignoring right and delta.
+ *
+ *		The space stays locked as long as the changes only
+ *		affect user-reference counts.  Releasing a right
+ *		may generate notifications, so this is done with
+ *		ipc_right_dealloc or ipc_right_delta, which unlock
+ *		the space.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+static void
+mach_port_delta_array(
+	ipc_space_t		space,
+	const mach_port_t	*names,
+	mach_msg_type_number_t	count,
+	boolean_t		dealloc,
+	mach_port_right_t	right,
+	mach_port_delta_t	delta,
+	kern_return_t		*results)
+{
+	mach_msg_type_number_t i;
+	boolean_t locked = FALSE;
+	ipc_entry_t entry;
+	mach_port_t name;
+
+	for (i = 0; i < count; i++) {
+		name = names[i];
+
+		if (!locked) {
+			is_write_lock(space);
+			locked = TRUE;
+		}
+
+		if (!space->is_active) {
+			results[i] = KERN_INVALID_TASK;
+			continue;
+		}
+
+		entry = ipc_entry_lookup(space, name);
+		if (entry == IE_NULL) {
+			results[i] = KERN_INVALID_NAME;
+			continue;
+		}
+
+		if (dealloc) {
+			if (entry->ie_bits & MACH_PORT_TYPE_SEND)
+				right = MACH_PORT_RIGHT_SEND;
+			else
+				right = MACH_PORT_RIGHT_DEAD_NAME;
+			delta = -1;
+		}
+
+		if (ipc_right_delta_locked(space, entry, right, delta)) {
+			results[i] = KERN_SUCCESS;
+			continue;
+		}
+
+		if (dealloc)
+			results[i] = ipc_right_dealloc(space, name, entry);
+		else
+			results[i] = ipc_right_delta(space, name, entry,
+						     right, delta);
+		/* space is unlocked */
+		locked = FALSE;
+	}
+
+	if (locked)
+		is_write_unlock(space);
+}
+
+/*
+ *	Routine:	mach_port_deallocate_array [kernel call]
+ *	Purpose:
+ *		Releases a user reference for each name,
+ *		like mach_port_deallocate.  The code for each
+ *		name is returned in results.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Attempted all deallocations.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_VALUE	Too many names.
+ */
+
+kern_return_t
+mach_port_deallocate_array(
+	ipc_space_t		space,
+	mach_port_array_t	names,
+	mach_msg_type_number_t	namesCnt,
+	kern_return_array_t	results,
+	mach_msg_type_number_t	*resultsCnt)
+{
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	if (namesCnt > *resultsCnt)
+		return KERN_INVALID_VALUE;
+
+	mach_port_delta_array(space, names, namesCnt, TRUE,
+			      MACH_PORT_RIGHT_NUMBER, 0, results);
+	*resultsCnt = namesCnt;
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	mach_port_mod_refs_array [kernel call]
+ *	Purpose:
+ *		Modifies the number of user references held by
+ *		the rights for each name, like mach_port_mod_refs.
+ *		The code for each name is returned in results.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Attempted all modifications.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_VALUE	"right" isn't a legal value.
+ *		KERN_INVALID_VALUE	Too many names.
+ */
+
+kern_return_t
+mach_port_mod_refs_array(
+	ipc_space_t		space,
+	mach_port_array_t	names,
+	mach_msg_type_number_t	namesCnt,
+	mach_port_right_t	right,
+	mach_port_delta_t	delta,
+	kern_return_array_t	results,
+	mach_msg_type_number_t	*resultsCnt)
+{
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	if (right >= MACH_PORT_RIGHT_NUMBER)
+		return KERN_INVALID_VALUE;
+
+	if (namesCnt > *resultsCnt)
+		return KERN_INVALID_VALUE;
+
+	mach_port_delta_array(space, names, namesCnt, FALSE,
+			      right, delta, results);
+	*resultsCnt = namesCnt;
+	return KERN_SUCCESS;
+}
+
 /*
  *	Routine:	mach_port_set_qlimit [kernel call]
  *	Purpose:
@@ -1576,3 +1782,96 @@ db_debug_port_references (boolean_t enable)
 }
 
 #endif	/* MACH_KDB */
+
+/*
+ *	Routine:	mach_port_set_dead_name_batching [kernel call]
+ *	Purpose:
+ *		Enables or disables the coalescing of dead-name
+ *		notifications sent to a receive right.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Changed the setting.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_TASK	The space is dead.
+ *		KERN_INVALID_NAME	The name doesn't denote a right.
+ *		KERN_INVALID_RIGHT	Name doesn't denote receive rights.
+ */
+
+kern_return_t
+mach_port_set_dead_name_batching(
+	ipc_space_t		space,
+	mach_port_t		name,
+	boolean_t		batching)
+{
+	ipc_port_t port;
+	kern_return_t kr;
+
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	kr = ipc_port_translate_receive(space, name, &port);
+	if (kr != KERN_SUCCESS)
+		return kr;
+	/* port is locked and active */
+
+	if (batching)
+		port->ip_flags |= IP_DNBATCH;
+	else
+		port->ip_flags &= ~IP_DNBATCH;
+
+	ip_unlock(port);
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	mach_port_set_queue_flags [kernel call]
+ *	Purpose:
+ *		Changes how a receive right's message queue is
+ *		ordered, and whether its receivers inherit the
+ *		priority of the senders.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Changed the flags.
+ *		KERN_INVALID_TASK	The space is null.
+ *		KERN_INVALID_TASK	The space is dead.
+ *		KERN_INVALID_NAME	The name doesn't denote a right.
+ *		KERN_INVALID_RIGHT	Name doesn't denote receive rights.
+ *		KERN_INVALID_VALUE	Unknown flags.
+ */
+
+kern_return_t
+mach_port_set_queue_flags(
+	ipc_space_t		space,
+	mach_port_t		name,
+	natural_t		flags)
+{
+	ipc_port_t port;
+	kern_return_t kr;
+
+	if (space == IS_NULL)
+		return KERN_INVALID_TASK;
+
+	if (flags & ~MACH_PORT_QUEUE_FLAGS)
+		return KERN_INVALID_VALUE;
+
+	kr = ipc_port_translate_receive(space, name, &port);
+	if (kr != KERN_SUCCESS)
+		return kr;
+	/* port is locked and active */
+
+	/*
+	 *	Messages already queued keep their order; only
+	 *	those sent from now on are placed by priority.
+	 */
+
+	port->ip_flags &= ~(IP_PRIOQ | IP_PRIOINHERIT);
+	if (flags & MACH_PORT_QUEUE_PRIORITY)
+		port->ip_flags |= IP_PRIOQ;
+	if (flags & MACH_PORT_QUEUE_INHERIT)
+		port->ip_flags |= IP_PRIOINHERIT;
+
+	ip_unlock(port);
+	return KERN_SUCCESS;
+}
@@ -51,4 +51,12 @@
 #define atomic_swap_seq(ptr, val)   \
   __atomic_swap_helper (ptr, val, SEQ_CST)
 
+/* Atomically load the value of *PTR, or store VAL into it, with no
+ * ordering constraint.  */
+#define atomic_load_rlx(ptr)   \
+  __atomic_load_n ((ptr), __ATOMIC_RELAXED)
+
+#define atomic_store_rlx(ptr, val)   \
+  __atomic_store_n ((ptr), (val), __ATOMIC_RELAXED)
+
 #endif
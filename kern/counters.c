@@ -56,6 +56,7 @@ mach_counter_t c_ipc_mqueue_receive_block_kernel = 0;
 mach_counter_t c_mach_msg_trap_block_fast = 0;
 mach_counter_t c_mach_msg_trap_block_slow = 0;
 mach_counter_t c_mach_msg_trap_block_exc = 0;
+mach_counter_t c_mach_msg_trap_kernel_call = 0;
 mach_counter_t c_exception_raise_block = 0;
 mach_counter_t c_swtch_block = 0;
 mach_counter_t c_swtch_pri_block = 0;
@@ -79,6 +79,7 @@ extern mach_counter_t c_ipc_mqueue_receive_block_kernel;
 extern mach_counter_t c_mach_msg_trap_block_fast;
 extern mach_counter_t c_mach_msg_trap_block_slow;
 extern mach_counter_t c_mach_msg_trap_block_exc;
+extern mach_counter_t c_mach_msg_trap_kernel_call;
 extern mach_counter_t c_exception_raise_block;
 extern mach_counter_t c_swtch_block;
 extern mach_counter_t c_swtch_pri_block;
@@ -47,6 +47,7 @@
 #include <ipc/ipc_thread.h>
 #include <vm/vm_object.h>
 #include <vm/memory_object_proxy.h>
+#include <vm/vm_channel.h>
 #include <device/ds_routines.h>
 
 #include <kern/mach.server.h>
@@ -67,6 +68,37 @@
 #endif
 
 
+/*
+ *	Routine:	ipc_kobject_init_reply
+ *	Purpose:
+ *		Initialize the header of the reply to a kernel
+ *		call, up to its return code.
+ */
+
+static void
+ipc_kobject_init_reply(
+	mach_msg_header_t	*InP,
+	mig_reply_header_t	*OutP)
+{
+	static mach_msg_type_t RetCodeType = {
+		/* msgt_name = */		MACH_MSG_TYPE_INTEGER_32,
+		/* msgt_size = */		32,
+		/* msgt_number = */		1,
+		/* msgt_inline = */		TRUE,
+		/* msgt_longform = */		FALSE,
+		/* msgt_unused = */		0
+	};
+
+	OutP->Head.msgh_bits =
+		MACH_MSGH_BITS(MACH_MSGH_BITS_LOCAL(InP->msgh_bits), 0);
+	OutP->Head.msgh_size = sizeof(mig_reply_header_t);
+	OutP->Head.msgh_remote_port = InP->msgh_local_port;
+	OutP->Head.msgh_local_port  = MACH_PORT_NULL;
+	OutP->Head.msgh_seqno = 0;
+	OutP->Head.msgh_id = InP->msgh_id + 100;
+	OutP->RetCodeType = RetCodeType;
+}
+
 /*
  *	Routine:	ipc_kobject_server
  *	Purpose:
@@ -80,19 +112,24 @@ ipc_kmsg_t
 ipc_kobject_server(request)
 	ipc_kmsg_t request;
 {
-	mach_msg_size_t reply_size = ikm_less_overhead(8192);
 	ipc_kmsg_t reply;
 	kern_return_t kr;
 	mig_routine_t routine;
 	ipc_port_t *destp;
 
-	reply = ikm_alloc(reply_size);
-	if (reply == IKM_NULL) {
-		printf("ipc_kobject_server: dropping request\n");
-		ipc_kmsg_destroy(request);
-		return IKM_NULL;
+	reply = ikm_reply_cache();
+	if (reply != IKM_NULL) {
+		ikm_reply_cache() = IKM_NULL;
+		ikm_check_initialized(reply, IKM_REPLY_KMSG_SIZE);
+	} else {
+		reply = ikm_alloc(IKM_REPLY_MSG_SIZE);
+		if (reply == IKM_NULL) {
+			printf("ipc_kobject_server: dropping request\n");
+			ipc_kmsg_destroy(request);
+			return IKM_NULL;
+		}
+		ikm_init(reply, IKM_REPLY_MSG_SIZE);
 	}
-	ikm_init(reply, reply_size);
 
 	/*
 	 * Initialize reply message.
@@ -101,21 +138,7 @@ ipc_kobject_server(request)
 #define	InP	((mach_msg_header_t *) &request->ikm_header)
 #define	OutP	((mig_reply_header_t *) &reply->ikm_header)
 
-	    static mach_msg_type_t RetCodeType = {
-		/* msgt_name = */		MACH_MSG_TYPE_INTEGER_32,
-		/* msgt_size = */		32,
-		/* msgt_number = */		1,
-		/* msgt_inline = */		TRUE,
-		/* msgt_longform = */		FALSE,
-		/* msgt_unused = */		0
-	    };
-	    OutP->Head.msgh_bits =
-		MACH_MSGH_BITS(MACH_MSGH_BITS_LOCAL(InP->msgh_bits), 0);
-	    OutP->Head.msgh_size = sizeof(mig_reply_header_t);
-	    OutP->Head.msgh_remote_port = InP->msgh_local_port;
-	    OutP->Head.msgh_local_port  = MACH_PORT_NULL;
-	    OutP->Head.msgh_seqno = 0;
-	    OutP->Head.msgh_id = InP->msgh_id + 100;
+	    ipc_kobject_init_reply(InP, OutP);
 #if 0
 	    if (InP->msgh_id) {
 		    static long _calls;
@@ -148,8 +171,6 @@ ipc_kobject_server(request)
 	    }
 #endif
 
-	    OutP->RetCodeType = RetCodeType;
-
 #undef	InP
 #undef	OutP
 	}
@@ -258,7 +279,10 @@ ipc_kobject_server(request)
 		 *	using the reply port right, which it has saved.
 		 */
 
-		ikm_free(reply);
+		if (ikm_reply_cache() == IKM_NULL)
+			ikm_reply_cache() = reply;
+		else
+			ikm_free(reply);
 		return IKM_NULL;
 	} else if (!IP_VALID((ipc_port_t)reply->ikm_header.msgh_remote_port)) {
 		/*
@@ -273,6 +297,77 @@ ipc_kobject_server(request)
 	return reply;
 }
 
+/*
+ *	Routine:	ipc_kobject_fast_routine
+ *	Purpose:
+ *		Return the server function of the request if it
+ *		is one of the kernel calls made often enough to be
+ *		run directly from mach_msg_trap, or 0.  These calls
+ *		take no port or out-of-line argument and always
+ *		reply.
+ */
+
+mig_routine_t
+ipc_kobject_fast_routine(request)
+	mach_msg_header_t *request;
+{
+	switch (request->msgh_id) {
+	    case 2012:	/* task_info */
+	    case 2021:	/* vm_allocate */
+	    case 2023:	/* vm_deallocate */
+		return mach_server_routine(request);
+
+	    case 3204:	/* mach_port_allocate */
+	    case 3206:	/* mach_port_deallocate */
+		return mach_port_server_routine(request);
+
+	    default:
+		return 0;
+	}
+}
+
+/*
+ *	Routine:	ipc_kobject_fast_server
+ *	Purpose:
+ *		Run a kernel call found by ipc_kobject_fast_routine.
+ *		The server function decodes the request in place
+ *		and builds its reply in the given kmsg, whose header
+ *		is left as ipc_kobject_server leaves it.  Unlike
+ *		the request of ipc_kobject_server, the request only
+ *		holds references for its ports, which the caller
+ *		keeps.  Consumes the request.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+void
+ipc_kobject_fast_server(routine, request, reply)
+	mig_routine_t routine;
+	ipc_kmsg_t request;
+	ipc_kmsg_t reply;
+{
+	ipc_kobject_init_reply(&request->ikm_header,
+			       (mig_reply_header_t *) &reply->ikm_header);
+
+	check_simple_locks();
+	(*routine)(&request->ikm_header, &reply->ikm_header);
+	kernel_task->messages_received++;
+	kernel_task->messages_sent++;
+	check_simple_locks();
+
+	assert(((mig_reply_header_t *) &reply->ikm_header)->RetCode
+	       != MIG_NO_REPLY);
+
+	/* like ipc_kmsg_put, but without the copyout */
+
+	ikm_check_initialized(request, request->ikm_size);
+	if ((request->ikm_size == IKM_SAVED_KMSG_SIZE) &&
+	    (ikm_cache() == IKM_NULL))
+		ikm_cache() = request;
+	else
+		ikm_free(request);
+}
+
 /*
  *	Routine:	ipc_kobject_set
  *	Purpose:
@@ -365,6 +460,9 @@ ipc_kobject_notify(request_header, reply_header)
 		case IKOT_PAGER_PROXY:
 		return memory_object_proxy_notify(request_header);
 
+		case IKOT_CHANNEL:
+		return vm_channel_notify(request_header);
+
 		default:
 		return FALSE;
 	}
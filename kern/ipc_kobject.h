@@ -40,6 +40,7 @@
 #define _KERN_IPC_KOBJECT_H_
 
 #include <mach/machine/vm_types.h>
+#include <mach/mig_errors.h>
 #include <ipc/ipc_types.h>
 #include <ipc/ipc_kmsg.h>
 
@@ -77,9 +78,10 @@ typedef unsigned int ipc_kobject_type_t;
 #define IKOT_CLOCK		25
 #define IKOT_CLOCK_CTRL		26
 #define	IKOT_PAGER_PROXY	27
+#define	IKOT_CHANNEL		28
 					/* << new entries here	*/
-#define	IKOT_UNKNOWN		28	/* magic catchall	*/
-#define	IKOT_MAX_TYPE		29	/* # of IKOT_ types	*/
+#define	IKOT_UNKNOWN		29	/* magic catchall	*/
+#define	IKOT_MAX_TYPE		30	/* # of IKOT_ types	*/
  /* Please keep ipc/ipc_object.c:ikot_print_array up to date	*/
 
 #define is_ipc_kobject(ikot)	(ikot != IKOT_NONE)
@@ -103,6 +105,16 @@ extern void mig_init(void);
 extern ipc_kmsg_t ipc_kobject_server(
 	ipc_kmsg_t	request);
 
+/* Find the server function of a kernel call run from mach_msg_trap */
+extern mig_routine_t ipc_kobject_fast_routine(
+	mach_msg_header_t	*request_header);
+
+/* Run a kernel call found by ipc_kobject_fast_routine */
+extern void ipc_kobject_fast_server(
+	mig_routine_t	routine,
+	ipc_kmsg_t	request,
+	ipc_kmsg_t	reply);
+
 /* Make a port represent a kernel object of the given type */
 extern void ipc_kobject_set(
 	ipc_port_t		port,
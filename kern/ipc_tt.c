@@ -231,6 +231,7 @@ ipc_thread_init(thread_t thread)
 
 	thread->ith_mig_reply = MACH_PORT_NULL;
 	thread->ith_rpc_reply = IP_NULL;
+	thread->ith_notify_batch = NULL;
 }
 
 /*
@@ -55,6 +55,7 @@
 #include <vm/pmap.h>
 #include <vm/vm_kern.h>
 #include <vm/vm_map.h>
+#include <vm/vm_page.h>
 
 #if	MACH_FIXPRI
 #include <mach/policy.h>
@@ -1030,6 +1031,7 @@ shift_data_t	wait_shift[32] = {
  *
  *	Take the base priority for this thread and add
  *	to it an increment derived from its cpu_usage.
+ *	This ends any boost from ipc_mqueue_receive.
  *
  *	The thread *must* be locked by the caller.
  */
@@ -1040,6 +1042,7 @@ void compute_priority(
 {
 	int	pri;
 
+	thread->boost_priority = -1;
 #if	MACH_FIXPRI
 	if (thread->policy == POLICY_TIMESHARE) {
 #endif	/* MACH_FIXPRI */
@@ -1064,6 +1067,7 @@ void compute_priority(
  *	Only used for priority updates.  Policy or priority changes
  *	must call compute_priority above.  Caller must have thread
  *	locked and know it is timesharing and not depressed.
+ *	Like compute_priority, this ends any boost.
  */
 
 void compute_my_priority(
@@ -1073,6 +1077,7 @@ void compute_my_priority(
 
 	do_priority_computation(thread,temp_pri);
 	thread->sched_pri = temp_pri;
+	thread->boost_priority = -1;
 }
 
 /*
@@ -1156,6 +1161,7 @@ void update_priority(
 	    (thread->depress_priority < 0)) {
 		do_priority_computation(thread, temp_pri);
 		thread->sched_pri = temp_pri;
+		thread->boost_priority = -1;
 	}
 }
 
@@ -1654,6 +1660,13 @@ void __attribute__((noreturn)) idle_thread_continue(void)
 				/* back at spl0 */
 			}
 
+			/*
+			 * Fill a free page with zeros for a later
+			 * zero-fill fault, and check for work again.
+			 */
+			if (vm_page_zero_idle())
+				continue;
+
 			/*
 			 * machine_idle is a machine dependent function,
 			 * to conserve power.
@@ -51,6 +51,7 @@
 #include <kern/bootstrap.h>
 #include <kern/time_stamp.h>
 #include <kern/startup.h>
+#include <vm/vm_dedup.h>
 #include <vm/vm_kern.h>
 #include <vm/vm_map.h>
 #include <vm/vm_object.h>
@@ -237,6 +238,8 @@ void start_kernel_threads(void)
 	(void) kernel_thread(kernel_task, reaper_thread, (char *) 0);
 	(void) kernel_thread(kernel_task, swapin_thread, (char *) 0);
 	(void) kernel_thread(kernel_task, sched_thread, (char *) 0);
+	(void) kernel_thread(kernel_task, vm_dedup_thread, (char *) 0);
+	(void) kernel_thread(kernel_task, vm_object_collapse_thread, (char *) 0);
 
 #if	NCPUS > 1
 	/*
@@ -337,6 +337,7 @@ void thread_init(void)
 	thread_template.policy = POLICY_TIMESHARE;
 #endif	/* MACH_FIXPRI */
 	thread_template.depress_priority = -1;
+	thread_template.boost_priority = -1;
 	thread_template.cpu_usage = 0;
 	thread_template.sched_usage = 0;
 	/* thread_template.sched_stamp (later) */
@@ -55,6 +55,12 @@
 #include <machine/thread.h>
 #include <ipc/ipc_kmsg_queue.h>
 
+/*
+ *	Number of map entries each thread remembers, see
+ *	vm_map_lookup_entry.
+ */
+#define	THREAD_VM_MAP_CACHE	4
+
 struct thread {
 	/* Run queues */
 	queue_chain_t	links;		/* current run queue links */
@@ -138,6 +144,7 @@ struct thread {
 	int		policy;		/* scheduling policy */
 #endif	/* MACH_FIXPRI */
 	int		depress_priority; /* depressed from this priority */
+	int		boost_priority;	/* raised by IPC from this priority */
 	unsigned int	cpu_usage;	/* exp. decaying cpu usage [%cpu] */
 	unsigned int	sched_usage;	/* load-weighted cpu usage [sched] */
 	unsigned int	sched_stamp;	/* last time priority was updated */
@@ -147,6 +154,12 @@ struct thread {
 	vm_offset_t	recover;	/* page fault recovery (copyin/out) */
 	unsigned int vm_privilege;	/* Can use reserved memory?
 					   Implemented as a counter */
+	struct vm_map_entry *vm_map_cache[THREAD_VM_MAP_CACHE];
+					/* entries of the task map
+					   recently looked up */
+	unsigned int	vm_map_cache_timestamp;	/* map version of
+						   the entries */
+	unsigned int	vm_map_cache_next;	/* entry to replace */
 
 	/* User-visible scheduling state */
 	int		user_stop_count;	/* outstanding stops */
@@ -174,6 +187,8 @@ struct thread {
 
 	mach_port_t ith_mig_reply;	/* reply port for mig */
 	struct ipc_port *ith_rpc_reply;	/* reply port for kernel RPCs */
+	struct ipc_notify_batch *ith_notify_batch;
+					/* pending dead-name notifications */
 
 	/* State saved when thread's stack is discarded */
 	union {
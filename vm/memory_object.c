@@ -638,6 +638,7 @@ memory_object_lock_request(
 	mach_msg_type_name_t	reply_to_type)
 {
 	vm_page_t		m;
+	vm_offset_t		end;
 	vm_offset_t		original_offset = offset;
 	vm_size_t		original_size = size;
 	vm_offset_t		paging_offset = 0;
@@ -669,6 +670,10 @@ memory_object_lock_request(
 	vm_object_paging_begin(object);
 	offset -= object->paging_offset;
 
+	end = offset + size;
+	if (end < offset)
+		end = (vm_offset_t) -1;
+
 	/*
 	 *	To avoid blocking while scanning for pages, save
 	 *	dirty pages to be cleaned all at once.
@@ -729,6 +734,18 @@ MACRO_END
 		PAGEOUT_PAGES;
 	    }
 
+	    /*
+	     *	Skip straight to the next resident page, instead
+	     *	of looking up every offset of a sparse range.
+	     */
+	    m = vm_page_lookup_range(object, offset, end);
+	    if (m == VM_PAGE_NULL)
+		break;
+	    if (trunc_page(m->offset - offset) != 0) {
+		size -= trunc_page(m->offset - offset);
+		offset += trunc_page(m->offset - offset);
+	    }
+
 	    while ((m = vm_page_lookup(object, offset)) != VM_PAGE_NULL) {
 		switch ((page_lock_result = memory_object_lock_page(m,
 					should_return,
@@ -973,6 +990,33 @@ kern_return_t	memory_object_get_attributes(
 	return(KERN_SUCCESS);
 }
 
+/*
+ *	Routine:	memory_object_set_cluster_size [user interface]
+ *	Purpose:
+ *		Set the largest data request the kernel may make to
+ *		the memory manager of the object.  Sequential pageins
+ *		then request the following pages along with the
+ *		faulting one; see vm_fault_page.
+ */
+kern_return_t	memory_object_set_cluster_size(
+	vm_object_t	object,
+	vm_size_t	cluster_size)
+{
+	if (object == VM_OBJECT_NULL)
+		return(KERN_INVALID_ARGUMENT);
+
+	cluster_size = trunc_page(cluster_size);
+	if (cluster_size < PAGE_SIZE)
+		cluster_size = PAGE_SIZE;
+
+	vm_object_lock(object);
+	object->cluster_size = cluster_size;
+	vm_object_unlock(object);
+
+	vm_object_deallocate(object);
+	return(KERN_SUCCESS);
+}
+
 /*
  *	If successful, consumes the supplied naked send right.
  */
@@ -173,6 +173,19 @@ extern void		pmap_copy(pmap_t, pmap_t, vm_offset_t, vm_size_t,
 extern kern_return_t	pmap_attribute(void);
 #endif	/* pmap_attribute */
 
+/*
+ *	Gather the TLB invalidations of the pmap_remove and
+ *	pmap_protect calls made until PMAP_BATCH_END, so that other
+ *	processors are signalled once for all of them.  Until then,
+ *	they may still use the old mappings: the caller must not
+ *	block, nor free or reuse pages it unmapped, before ending
+ *	the batch.
+ */
+#ifndef	PMAP_BATCH_BEGIN
+#define	PMAP_BATCH_BEGIN()
+#define	PMAP_BATCH_END()
+#endif	/* PMAP_BATCH_BEGIN */
+
 /*
  *	Grab a physical page:
  *	the standard memory allocation mechanism
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *	File:	vm/vm_channel.c
+ *
+ *	Shared memory ring channels between tasks.
+ *
+ *	A channel is a kernel port naming an internal VM object which
+ *	holds two rings, see <mach/channel.h>.  vm_map accepts the port
+ *	in place of a memory object and maps the channel object itself,
+ *	so all mappings share the same pages.  Once mapped, the rings are
+ *	driven from user space alone; the kernel is only entered through
+ *	gsync_wait/gsync_wake when a side has to sleep.
+ *
+ *	The channel holds the reference for its object until the last
+ *	send right for the port is gone.  Existing mappings hold their
+ *	own references and outlive the channel.
+ */
+
+#include <mach/channel.h>
+#include <mach/kern_return.h>
+#include <mach/notify.h>
+#include <mach/vm_param.h>
+#include <kern/assert.h>
+#include <kern/debug.h>
+#include <kern/ipc_kobject.h>
+#include <kern/printf.h>
+#include <kern/slab.h>
+#include <ipc/ipc_port.h>
+#include <ipc/ipc_space.h>
+#include <vm/vm_channel.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+
+/*
+ *	Upper bound for the data area of one ring.
+ */
+#define	VM_CHANNEL_RING_MAX	(16 * 1024 * 1024)
+
+struct vm_channel {
+	struct ipc_port	*port;		/* kernel port, IKOT_CHANNEL */
+	vm_object_t	object;		/* ring headers and data */
+};
+typedef struct vm_channel *vm_channel_t;
+
+#define	VM_CHANNEL_NULL	((vm_channel_t) 0)
+
+static struct kmem_cache vm_channel_cache;
+
+void
+vm_channel_init(void)
+{
+	kmem_cache_init(&vm_channel_cache, "vm_channel",
+			sizeof(struct vm_channel), 0, NULL, 0);
+}
+
+/*
+ *	Routine:	vm_channel_port_lookup
+ *	Purpose:
+ *		Return the channel named by a port, if any.
+ *	Conditions:
+ *		Nothing locked.  The caller holds a reference
+ *		for the port.
+ */
+static vm_channel_t
+vm_channel_port_lookup(ipc_port_t port)
+{
+	vm_channel_t channel;
+
+	if (!IP_VALID(port))
+		return VM_CHANNEL_NULL;
+
+	ip_lock(port);
+	if (ip_active(port) && (ip_kotype(port) == IKOT_CHANNEL))
+		channel = (vm_channel_t) port->ip_kobject;
+	else
+		channel = VM_CHANNEL_NULL;
+	ip_unlock(port);
+
+	return channel;
+}
+
+/*
+ *	Routine:	vm_channel_lookup
+ *	Purpose:
+ *		Return the VM object of the channel named by a port,
+ *		with a new reference, or VM_OBJECT_NULL if the port
+ *		doesn't name a channel.
+ *	Conditions:
+ *		Nothing locked.  The caller holds a send right
+ *		for the port, which keeps the channel alive.
+ */
+vm_object_t
+vm_channel_lookup(ipc_port_t port)
+{
+	vm_channel_t channel;
+
+	channel = vm_channel_port_lookup(port);
+	if (channel == VM_CHANNEL_NULL)
+		return VM_OBJECT_NULL;
+
+	vm_object_reference(channel->object);
+	return channel->object;
+}
+
+/*
+ *	Routine:	vm_channel_notify
+ *	Purpose:
+ *		Destroy a channel once its last send right is gone.
+ */
+boolean_t
+vm_channel_notify(mach_msg_header_t *msg)
+{
+	vm_channel_t channel;
+
+	if (msg->msgh_id != MACH_NOTIFY_NO_SENDERS) {
+		printf("vm_channel_notify: strange notification %d\n",
+		       msg->msgh_id);
+		return FALSE;
+	}
+
+	channel = vm_channel_port_lookup((ipc_port_t) msg->msgh_remote_port);
+	assert(channel != VM_CHANNEL_NULL);
+
+	ipc_kobject_set(channel->port, IKO_NULL, IKOT_NONE);
+	ipc_port_dealloc_kernel(channel->port);
+	vm_object_deallocate(channel->object);
+	kmem_cache_free(&vm_channel_cache, (vm_offset_t) channel);
+	return TRUE;
+}
+
+/*
+ *	Routine:	vm_channel_setup
+ *	Purpose:
+ *		Initialize the ring headers in the first page
+ *		of a new channel object.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static kern_return_t
+vm_channel_setup(
+	vm_object_t	object,
+	vm_size_t	ring_size)
+{
+	struct channel_ring *ring;
+	vm_offset_t addr;
+	kern_return_t kr;
+	int i;
+
+	/*
+	 *	Map the header page in the kernel, wired, for the
+	 *	time it takes to fill it.
+	 */
+
+	addr = vm_map_min(kernel_map);
+	vm_object_reference(object);
+	kr = vm_map_enter(kernel_map, &addr, PAGE_SIZE, (vm_offset_t) 0,
+			  TRUE, object, 0, FALSE,
+			  VM_PROT_READ | VM_PROT_WRITE,
+			  VM_PROT_READ | VM_PROT_WRITE,
+			  VM_INHERIT_NONE);
+	if (kr != KERN_SUCCESS) {
+		vm_object_deallocate(object);
+		return kr;
+	}
+
+	kr = vm_map_pageable(kernel_map, addr, addr + PAGE_SIZE,
+			     VM_PROT_READ | VM_PROT_WRITE, TRUE, FALSE);
+	if (kr != KERN_SUCCESS) {
+		(void) vm_map_remove(kernel_map, addr, addr + PAGE_SIZE);
+		return kr;
+	}
+
+	for (i = CHANNEL_RING_FORWARD; i <= CHANNEL_RING_BACKWARD; i++) {
+		ring = CHANNEL_RING(addr, i);
+		ring->cr_head = 0;
+		ring->cr_tail = 0;
+		ring->cr_consumer_waiting = 0;
+		ring->cr_producer_waiting = 0;
+		ring->cr_size = ring_size;
+		ring->cr_data = PAGE_SIZE + i * ring_size;
+	}
+
+	(void) vm_map_remove(kernel_map, addr, addr + PAGE_SIZE);
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	channel_create [kernel call]
+ *	Purpose:
+ *		Create a channel with two rings of ring_size bytes
+ *		each, and return a send right for its port, along
+ *		with the size to pass to vm_map to map it.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Created the channel.
+ *		KERN_INVALID_TASK	The task is null.
+ *		KERN_INVALID_ARGUMENT	ring_size isn't a power of two,
+ *					or is too large.
+ *		KERN_RESOURCE_SHORTAGE	Couldn't allocate the channel.
+ */
+kern_return_t
+channel_create(
+	task_t		task,
+	vm_size_t	ring_size,
+	ipc_port_t	*channelp,
+	vm_size_t	*sizep)
+{
+	vm_channel_t channel;
+	vm_object_t object;
+	ipc_port_t notify;
+	vm_size_t size;
+	kern_return_t kr;
+
+	if (task == TASK_NULL)
+		return KERN_INVALID_TASK;
+
+	if ((ring_size == 0) || (ring_size & (ring_size - 1)) ||
+	    (ring_size > VM_CHANNEL_RING_MAX))
+		return KERN_INVALID_ARGUMENT;
+
+	ring_size = round_page(ring_size);
+	size = PAGE_SIZE + 2 * ring_size;
+
+	object = vm_object_allocate(size);
+	kr = vm_channel_setup(object, ring_size);
+	if (kr != KERN_SUCCESS) {
+		vm_object_deallocate(object);
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	channel = (vm_channel_t) kmem_cache_alloc(&vm_channel_cache);
+	if (channel == VM_CHANNEL_NULL) {
+		vm_object_deallocate(object);
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	channel->port = ipc_port_alloc_kernel();
+	if (channel->port == IP_NULL) {
+		kmem_cache_free(&vm_channel_cache, (vm_offset_t) channel);
+		vm_object_deallocate(object);
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	channel->object = object;
+	ipc_kobject_set(channel->port, (ipc_kobject_t) channel, IKOT_CHANNEL);
+
+	/* Request no-senders notifications on the port.  */
+	notify = ipc_port_make_sonce(channel->port);
+	ip_lock(channel->port);
+	ipc_port_nsrequest(channel->port, 1, notify, &notify);
+	assert(notify == IP_NULL);
+
+	*channelp = ipc_port_make_send(channel->port);
+	*sizep = size;
+	return KERN_SUCCESS;
+}
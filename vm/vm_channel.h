@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VM_VM_CHANNEL_H_
+#define _VM_VM_CHANNEL_H_
+
+#include <ipc/ipc_types.h>
+#include <mach/boolean.h>
+#include <mach/message.h>
+#include <kern/task.h>
+#include <vm/vm_object.h>
+
+extern void vm_channel_init(void);
+extern boolean_t vm_channel_notify(mach_msg_header_t *msg);
+extern vm_object_t vm_channel_lookup(ipc_port_t port);
+
+extern kern_return_t channel_create(
+	task_t		task,
+	vm_size_t	ring_size,
+	ipc_port_t	*channel,
+	vm_size_t	*size);
+
+#endif /* _VM_VM_CHANNEL_H_ */
@@ -0,0 +1,716 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *	File:	vm/vm_compress.c
+ *
+ *	Compressed cache of anonymous memory.
+ *
+ *	Dirty pages evicted from internal objects are compressed and kept
+ *	in memory instead of being sent to the default pager, and faults
+ *	on them are resolved by vm_fault_page without leaving the kernel.
+ *	When the cache is full, the oldest data is written back to the
+ *	default pager through the regular pageout path.
+ *
+ *	Compressed data is stored in pool pages, grabbed from the free
+ *	page queue without blocking.  Each pool page holds up to two
+ *	entries, one growing from the start of its data area and one from
+ *	the end.  The entry descriptors live in the header of the pool
+ *	page, so that storing a page never allocates anything else.
+ *
+ *	Only objects with a pager have entries, which keeps the shadow
+ *	chain bypass from skipping them, and lets a fault find them where
+ *	it would otherwise ask the pager.  Entries are indexed by offset in
+ *	a red-black tree of their object, protected by the object lock.
+ *	Changing an entry also requires vm_compress_lock, which protects
+ *	the pool.  The lock order is object, workspace, pool.
+ */
+
+#include <string.h>
+#include <mach/vm_param.h>
+#include <kern/assert.h>
+#include <kern/debug.h>
+#include <kern/list.h>
+#include <kern/lock.h>
+#include <kern/macros.h>
+#include <kern/printf.h>
+#include <kern/rbtree.h>
+#include <machine/pmap.h>
+#include <vm/pmap.h>
+#include <vm/vm_compress.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
+#include <vm/vm_pageout.h>
+#include <vm/vm_resident.h>
+
+/*
+ *	Compression format.
+ *
+ *	The output is a sequence of groups of up to eight items, each
+ *	group preceded by a control byte whose bits, from the lowest,
+ *	tell whether the item is a literal byte (0) or a match (1).
+ *	A match takes two bytes holding its length minus
+ *	VM_COMPRESS_MATCH_MIN in the high nibble and its distance in the
+ *	remaining twelve bits.  A length nibble of 15 is followed by a
+ *	third byte extending the length.
+ */
+#define	VM_COMPRESS_MATCH_MIN	3
+#define	VM_COMPRESS_MATCH_EXT	(VM_COMPRESS_MATCH_MIN + 15)
+#define	VM_COMPRESS_MATCH_MAX	(VM_COMPRESS_MATCH_EXT + 255)
+#define	VM_COMPRESS_DIST_MAX	4095
+#define	VM_COMPRESS_HASH_BITS	12
+
+/*
+ *	Compressed entry.
+ */
+struct vm_compress_entry {
+	struct rbtree_node	tree_node;	/* object tree link (O) */
+	vm_object_t		object;		/* owner, null if free */
+	vm_offset_t		offset;		/* offset in the owner */
+	unsigned short		start;		/* data offset in the page */
+	unsigned short		size;		/* data size */
+};
+
+/*
+ *	Header of a pool page.
+ */
+struct vm_compress_page {
+	struct list		lru_node;	/* all pool pages */
+	struct list		free_node;	/* pages with one free entry */
+	vm_page_t		page;		/* physical page */
+	struct vm_compress_entry entries[2];
+};
+
+#define	VM_COMPRESS_DATA_START	sizeof(struct vm_compress_page)
+#define	VM_COMPRESS_DATA_SIZE	(PAGE_SIZE - VM_COMPRESS_DATA_START)
+
+/*
+ *	Pages compressing to more than this aren't worth keeping.
+ *	At half the data area, a pool page always holds two entries,
+ *	so that a new pool page is paid back by the next store.
+ */
+#define	VM_COMPRESS_SIZE_MAX	(VM_COMPRESS_DATA_SIZE / 2)
+
+/*
+ *	Number of pool pages to examine when looking for room,
+ *	or for data to write back.
+ */
+#define	VM_COMPRESS_SEARCH_MAX	8
+
+/*
+ *	Default maximum size of the cache, as a fraction of
+ *	physical memory, and maximum number of entries written
+ *	back on each call to vm_compress_balance.
+ */
+#define	VM_COMPRESS_MAX_DENOM	8
+#define	VM_COMPRESS_WRITEBACK_MAX	2
+
+unsigned long vm_compress_max_pages;
+
+/*
+ *	Statistics.
+ */
+unsigned long vm_compress_nr_pages;	/* pool pages */
+unsigned long vm_compress_nr_entries;	/* compressed pages */
+unsigned long vm_compress_stores;
+unsigned long vm_compress_rejects;	/* didn't compress well */
+unsigned long vm_compress_misses;	/* cache was full */
+unsigned long vm_compress_hits;		/* faults resolved */
+unsigned long vm_compress_writebacks;
+
+/*
+ *	Pool pages in least recently stored order, and those
+ *	with a free entry.
+ */
+decl_simple_lock_data(static, vm_compress_lock)
+static struct list vm_compress_lru;
+static struct list vm_compress_free_pages;
+
+/*
+ *	Compression workspace.  Pages are copied to and from it with
+ *	pmap_copy_page, so that they don't need to be directly mapped.
+ */
+decl_simple_lock_data(static, vm_compress_work_lock)
+static struct {
+	unsigned char	page[PAGE_SIZE];
+	unsigned char	data[PAGE_SIZE];
+	unsigned short	hash[1 << VM_COMPRESS_HASH_BITS];
+} vm_compress_work __aligned(PAGE_SIZE);
+
+static inline unsigned int
+vm_compress_hash(const unsigned char *p)
+{
+	unsigned int x;
+
+	x = (p[0] << 16) | (p[1] << 8) | p[2];
+	return (x * 2654435761U) >> (32 - VM_COMPRESS_HASH_BITS);
+}
+
+/*
+ *	Compress a page into at most size_max bytes, and return the size
+ *	of the result, or 0 if it doesn't fit.
+ */
+static unsigned int
+vm_compress_lz(
+	const unsigned char	*src,
+	unsigned char		*dst,
+	unsigned int		size_max)
+{
+	unsigned short *hash = vm_compress_work.hash;
+	unsigned int ip, op, ctrl, bit, h, ref, len, max;
+
+	memset(hash, 0, sizeof(vm_compress_work.hash));
+	ip = 0;
+	op = 0;
+	ctrl = 0;
+	bit = 8;
+
+	while (ip < PAGE_SIZE) {
+		if (bit == 8) {
+			/* Room for a control byte and eight matches */
+			if (op + 1 + 8 * 3 > size_max)
+				return 0;
+
+			ctrl = op++;
+			dst[ctrl] = 0;
+			bit = 0;
+		}
+
+		if (ip + VM_COMPRESS_MATCH_MIN <= PAGE_SIZE) {
+			/*
+			 *	Positions are stored plus one, so that empty
+			 *	slots wrap around to a reference above ip.
+			 */
+			h = vm_compress_hash(&src[ip]);
+			ref = hash[h] - 1;
+			hash[h] = ip + 1;
+
+			if ((ref < ip) && (ip - ref <= VM_COMPRESS_DIST_MAX)
+			    && (src[ref] == src[ip])
+			    && (src[ref + 1] == src[ip + 1])
+			    && (src[ref + 2] == src[ip + 2])) {
+				max = PAGE_SIZE - ip;
+				if (max > VM_COMPRESS_MATCH_MAX)
+					max = VM_COMPRESS_MATCH_MAX;
+
+				for (len = VM_COMPRESS_MATCH_MIN;
+				     (len < max) && (src[ref + len] == src[ip + len]);
+				     len++)
+					continue;
+
+				dst[ctrl] |= 1 << bit;
+
+				if (len < VM_COMPRESS_MATCH_EXT) {
+					dst[op++] = ((len - VM_COMPRESS_MATCH_MIN) << 4)
+						    | ((ip - ref) >> 8);
+					dst[op++] = (ip - ref) & 0xff;
+				} else {
+					dst[op++] = (15 << 4) | ((ip - ref) >> 8);
+					dst[op++] = (ip - ref) & 0xff;
+					dst[op++] = len - VM_COMPRESS_MATCH_EXT;
+				}
+
+				ip += len;
+				bit++;
+				continue;
+			}
+		}
+
+		dst[op++] = src[ip++];
+		bit++;
+	}
+
+	return op;
+}
+
+/*
+ *	Decompress size bytes into a page.  Returns FALSE if
+ *	the data is corrupted.
+ */
+static boolean_t
+vm_compress_unlz(
+	const unsigned char	*src,
+	unsigned int		size,
+	unsigned char		*dst)
+{
+	unsigned int ip, op, ctrl, bit, len, dist;
+
+	ip = 0;
+	op = 0;
+
+	while (op < PAGE_SIZE) {
+		if (ip >= size)
+			return FALSE;
+
+		ctrl = src[ip++];
+
+		for (bit = 0; (bit < 8) && (op < PAGE_SIZE); bit++) {
+			if (!(ctrl & (1 << bit))) {
+				if (ip >= size)
+					return FALSE;
+
+				dst[op++] = src[ip++];
+				continue;
+			}
+
+			if (ip + 2 > size)
+				return FALSE;
+
+			len = (src[ip] >> 4) + VM_COMPRESS_MATCH_MIN;
+			dist = ((src[ip] & 0xf) << 8) | src[ip + 1];
+			ip += 2;
+
+			if (len == VM_COMPRESS_MATCH_EXT) {
+				if (ip >= size)
+					return FALSE;
+
+				len += src[ip++];
+			}
+
+			if ((dist == 0) || (dist > op) || (len > PAGE_SIZE - op))
+				return FALSE;
+
+			for (; len != 0; len--, op++)
+				dst[op] = dst[op - dist];
+		}
+	}
+
+	return (ip == size);
+}
+
+static inline int
+vm_compress_cmp_lookup(
+	vm_offset_t		offset,
+	const struct rbtree_node *node)
+{
+	struct vm_compress_entry *entry;
+
+	entry = rbtree_entry(node, struct vm_compress_entry, tree_node);
+
+	if (offset < entry->offset)
+		return -1;
+	else if (offset > entry->offset)
+		return 1;
+	else
+		return 0;
+}
+
+static inline struct vm_compress_page *
+vm_compress_entry_page(struct vm_compress_entry *entry)
+{
+	return (struct vm_compress_page *) trunc_page((vm_offset_t) entry);
+}
+
+static inline unsigned char *
+vm_compress_entry_data(struct vm_compress_entry *entry)
+{
+	return (unsigned char *) vm_compress_entry_page(entry) + entry->start;
+}
+
+static inline struct vm_compress_entry *
+vm_compress_entry_other(struct vm_compress_entry *entry)
+{
+	struct vm_compress_page *cpage = vm_compress_entry_page(entry);
+
+	return &cpage->entries[entry == &cpage->entries[0]];
+}
+
+/*
+ *	Find room for size bytes of compressed data, adding a pool
+ *	page if needed and allowed.  No page is added when memory
+ *	is low, since storing into it would free nothing yet.
+ *	Returns a free entry with its start and size set, or NULL.
+ *
+ *	The pool must be locked.
+ */
+static struct vm_compress_entry *
+vm_compress_entry_alloc(
+	unsigned int	size,
+	boolean_t	low_memory)
+{
+	struct vm_compress_page *cpage;
+	struct vm_compress_entry *entry;
+	vm_page_t page;
+	int i = 0;
+
+	list_for_each_entry(&vm_compress_free_pages, cpage, free_node) {
+		if (cpage->entries[0].object == VM_OBJECT_NULL)
+			entry = &cpage->entries[0];
+		else
+			entry = &cpage->entries[1];
+
+		if (vm_compress_entry_other(entry)->size + size
+		    <= VM_COMPRESS_DATA_SIZE) {
+			list_remove(&cpage->free_node);
+			goto found;
+		}
+
+		if (++i >= VM_COMPRESS_SEARCH_MAX)
+			break;
+	}
+
+	if (low_memory || (vm_compress_nr_pages >= vm_compress_max_pages))
+		return NULL;
+
+	page = vm_page_grab();
+	if (page == VM_PAGE_NULL)
+		return NULL;
+
+	cpage = (struct vm_compress_page *) phystokv(vm_page_to_pa(page));
+	cpage->page = page;
+	cpage->entries[0].object = VM_OBJECT_NULL;
+	cpage->entries[0].size = 0;
+	cpage->entries[1].object = VM_OBJECT_NULL;
+	cpage->entries[1].size = 0;
+	list_insert_tail(&vm_compress_lru, &cpage->lru_node);
+	list_insert_tail(&vm_compress_free_pages, &cpage->free_node);
+	vm_compress_nr_pages++;
+	entry = &cpage->entries[0];
+
+found:
+	if (entry == &cpage->entries[0])
+		entry->start = VM_COMPRESS_DATA_START;
+	else
+		entry->start = PAGE_SIZE - size;
+
+	entry->size = size;
+	return entry;
+}
+
+/*
+ *	Release an entry, and its pool page if it was the last one
+ *	in use.  The entry must have been removed from its object.
+ *
+ *	The pool must be locked.
+ */
+static void
+vm_compress_entry_free(struct vm_compress_entry *entry)
+{
+	struct vm_compress_page *cpage = vm_compress_entry_page(entry);
+
+	entry->object = VM_OBJECT_NULL;
+	entry->size = 0;
+	vm_compress_nr_entries--;
+
+	if (vm_compress_entry_other(entry)->object == VM_OBJECT_NULL) {
+		list_remove(&cpage->free_node);
+		list_remove(&cpage->lru_node);
+		vm_compress_nr_pages--;
+		vm_page_release(cpage->page, FALSE, FALSE);
+	} else {
+		list_insert_tail(&vm_compress_free_pages, &cpage->free_node);
+	}
+}
+
+/*
+ *	Decompress an entry into a page.
+ *
+ *	The object of the entry must be locked.
+ */
+static void
+vm_compress_entry_read(
+	struct vm_compress_entry *entry,
+	vm_page_t		m)
+{
+	simple_lock(&vm_compress_work_lock);
+
+	if (!vm_compress_unlz(vm_compress_entry_data(entry), entry->size,
+			      vm_compress_work.page))
+		panic("vm_compress: corrupted data at %p", entry);
+
+	pmap_copy_page(kvtophys((vm_offset_t) vm_compress_work.page),
+		       m->phys_addr);
+	simple_unlock(&vm_compress_work_lock);
+}
+
+void
+vm_compress_init(void)
+{
+	simple_lock_init(&vm_compress_lock);
+	simple_lock_init(&vm_compress_work_lock);
+	list_init(&vm_compress_lru);
+	list_init(&vm_compress_free_pages);
+	vm_compress_max_pages = vm_page_table_size() / VM_COMPRESS_MAX_DENOM;
+}
+
+boolean_t
+vm_compress_page(
+	vm_page_t	m,
+	boolean_t	low_memory)
+{
+	vm_object_t object = m->object;
+	struct vm_compress_entry *entry;
+	struct rbtree_node *node;
+	unsigned long slot;
+	unsigned int size;
+
+	assert(object->internal && object->pager_initialized);
+	assert(m->busy && !m->precious && !m->wire_count);
+
+	if (vm_compress_max_pages == 0)
+		return FALSE;
+
+	simple_lock(&vm_compress_work_lock);
+	pmap_copy_page(m->phys_addr,
+		       kvtophys((vm_offset_t) vm_compress_work.page));
+	size = vm_compress_lz(vm_compress_work.page, vm_compress_work.data,
+			      VM_COMPRESS_SIZE_MAX);
+
+	if (size == 0) {
+		simple_unlock(&vm_compress_work_lock);
+		vm_compress_rejects++;
+		return FALSE;
+	}
+
+	simple_lock(&vm_compress_lock);
+	entry = vm_compress_entry_alloc(size, low_memory);
+
+	if (entry == NULL) {
+		simple_unlock(&vm_compress_lock);
+		simple_unlock(&vm_compress_work_lock);
+		vm_compress_misses++;
+		return FALSE;
+	}
+
+	memcpy(vm_compress_entry_data(entry), vm_compress_work.data, size);
+	entry->object = object;
+	entry->offset = m->offset;
+
+	node = rbtree_lookup_slot(&object->compressed_tree, m->offset,
+				  vm_compress_cmp_lookup, slot);
+	assert(node == NULL);
+	rbtree_insert_slot(&object->compressed_tree, slot, &entry->tree_node);
+
+	/*
+	 *	Faults only look for data of offsets the pager may have.
+	 */
+#if	MACH_PAGEMAP
+	vm_external_state_set(object->existence_info,
+			      m->offset + object->paging_offset,
+			      VM_EXTERNAL_STATE_EXISTS);
+#endif	/* MACH_PAGEMAP */
+
+	list_remove(&vm_compress_entry_page(entry)->lru_node);
+	list_insert_tail(&vm_compress_lru,
+			 &vm_compress_entry_page(entry)->lru_node);
+	vm_compress_nr_entries++;
+	vm_compress_stores++;
+	simple_unlock(&vm_compress_lock);
+	simple_unlock(&vm_compress_work_lock);
+
+	VM_PAGE_FREE(m);
+	return TRUE;
+}
+
+boolean_t
+vm_compress_fault(vm_page_t m)
+{
+	vm_object_t object = m->object;
+	struct vm_compress_entry *entry;
+	struct rbtree_node *node;
+
+	if (rbtree_empty(&object->compressed_tree))
+		return FALSE;
+
+	node = rbtree_lookup(&object->compressed_tree, m->offset,
+			     vm_compress_cmp_lookup);
+	if (node == NULL)
+		return FALSE;
+
+	entry = rbtree_entry(node, struct vm_compress_entry, tree_node);
+	vm_compress_entry_read(entry, m);
+	rbtree_remove(&object->compressed_tree, node);
+
+	simple_lock(&vm_compress_lock);
+	vm_compress_entry_free(entry);
+	vm_compress_hits++;
+	simple_unlock(&vm_compress_lock);
+
+	/* The pager doesn't have this data */
+	m->dirty = TRUE;
+	return TRUE;
+}
+
+void
+vm_compress_page_remove(
+	vm_object_t	object,
+	vm_offset_t	start,
+	vm_offset_t	end)
+{
+	struct vm_compress_entry *entry;
+	struct rbtree_node *node, *next;
+
+	if (rbtree_empty(&object->compressed_tree))
+		return;
+
+	node = rbtree_lookup_nearest(&object->compressed_tree, start,
+				     vm_compress_cmp_lookup, RBTREE_RIGHT);
+
+	simple_lock(&vm_compress_lock);
+
+	while (node != NULL) {
+		entry = rbtree_entry(node, struct vm_compress_entry, tree_node);
+
+		if (entry->offset >= end)
+			break;
+
+		next = rbtree_next(node);
+		rbtree_remove(&object->compressed_tree, node);
+		vm_compress_entry_free(entry);
+		node = next;
+	}
+
+	simple_unlock(&vm_compress_lock);
+}
+
+void
+vm_compress_collapse(
+	vm_object_t	object,
+	vm_object_t	backing_object,
+	vm_offset_t	backing_offset)
+{
+	struct vm_compress_entry *entry;
+	struct rbtree_node *node;
+	vm_offset_t new_offset;
+	unsigned long slot;
+
+	if (rbtree_empty(&backing_object->compressed_tree))
+		return;
+
+	simple_lock(&vm_compress_lock);
+
+	while ((node = rbtree_first(&backing_object->compressed_tree))
+	       != NULL) {
+		entry = rbtree_entry(node, struct vm_compress_entry, tree_node);
+		rbtree_remove(&backing_object->compressed_tree, node);
+		new_offset = entry->offset - backing_offset;
+
+		/*
+		 *	Like resident pages, data outside the parent or
+		 *	shadowed by one of its pages is thrown away.
+		 */
+
+		if ((entry->offset < backing_offset) ||
+		    (new_offset >= object->size) ||
+		    (vm_page_lookup(object, new_offset) != VM_PAGE_NULL)) {
+			vm_compress_entry_free(entry);
+			continue;
+		}
+
+		node = rbtree_lookup_slot(&object->compressed_tree, new_offset,
+					  vm_compress_cmp_lookup, slot);
+		assert(node == NULL);
+		entry->object = object;
+		entry->offset = new_offset;
+		rbtree_insert_slot(&object->compressed_tree, slot,
+				   &entry->tree_node);
+	}
+
+	simple_unlock(&vm_compress_lock);
+}
+
+/*
+ *	Write the oldest entry whose object can be locked back
+ *	to the default pager.  Returns FALSE if none could.
+ */
+static boolean_t
+vm_compress_writeback(void)
+{
+	struct vm_compress_page *cpage;
+	struct vm_compress_entry *entry;
+	vm_object_t object;
+	vm_offset_t offset;
+	vm_page_t m;
+	int i, j;
+
+	m = vm_page_grab();
+	if (m == VM_PAGE_NULL)
+		return FALSE;
+
+	simple_lock(&vm_compress_lock);
+	i = 0;
+
+	list_for_each_entry(&vm_compress_lru, cpage, lru_node) {
+		for (j = 0; j < 2; j++) {
+			entry = &cpage->entries[j];
+
+			if ((entry->object != VM_OBJECT_NULL) &&
+			    vm_object_lock_try(entry->object))
+				goto found;
+		}
+
+		if (++i >= VM_COMPRESS_SEARCH_MAX)
+			break;
+	}
+
+	simple_unlock(&vm_compress_lock);
+	vm_page_release(m, FALSE, FALSE);
+	return FALSE;
+
+found:
+	/*
+	 *	The entry can't go away while its object is locked.
+	 */
+
+	object = entry->object;
+	offset = entry->offset;
+	simple_unlock(&vm_compress_lock);
+
+	if (vm_page_lookup(object, offset) != VM_PAGE_NULL) {
+		vm_object_unlock(object);
+		vm_page_release(m, FALSE, FALSE);
+		return FALSE;
+	}
+
+	if (object->alive)
+		vm_compress_entry_read(entry, m);
+
+	rbtree_remove(&object->compressed_tree, &entry->tree_node);
+	simple_lock(&vm_compress_lock);
+	vm_compress_entry_free(entry);
+	simple_unlock(&vm_compress_lock);
+
+	if (!object->alive) {
+		vm_object_unlock(object);
+		vm_page_release(m, FALSE, FALSE);
+		return TRUE;
+	}
+
+	vm_page_lock_queues();
+	vm_page_insert(m, object, offset);
+	vm_page_unlock_queues();
+	m->dirty = TRUE;
+
+	vm_pageout_page(m, FALSE, TRUE);	/* flush it */
+	vm_object_unlock(object);
+	vm_compress_writebacks++;
+	return TRUE;
+}
+
+void
+vm_compress_balance(void)
+{
+	int i;
+
+	for (i = 0; i < VM_COMPRESS_WRITEBACK_MAX; i++) {
+		if (vm_compress_nr_pages < vm_compress_max_pages)
+			break;
+
+		if (!vm_compress_writeback())
+			break;
+	}
+}
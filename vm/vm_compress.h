@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VM_VM_COMPRESS_H_
+#define _VM_VM_COMPRESS_H_
+
+#include <mach/boolean.h>
+#include <mach/machine/vm_types.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
+
+/*
+ *	Maximum number of physical pages holding compressed data.
+ *	Zero disables the compressed cache.
+ */
+extern unsigned long vm_compress_max_pages;
+
+extern void vm_compress_init(void);
+
+/*
+ *	Compress an evicted page of an internal object and free it.
+ *	Returns FALSE, leaving the page alone, if it doesn't compress
+ *	well or the cache is full.  When memory is low, only room left
+ *	in the cache is used.  The object must be locked.
+ */
+extern boolean_t vm_compress_page(vm_page_t m, boolean_t low_memory);
+
+/*
+ *	Fill a page with the compressed data for its object and offset,
+ *	if any, and mark it dirty.  Returns FALSE if there is no such
+ *	data.  The object must be locked.
+ */
+extern boolean_t vm_compress_fault(vm_page_t m);
+
+/*
+ *	Discard the compressed data of an object in [start, end).
+ *	The object must be locked.
+ */
+extern void vm_compress_page_remove(
+	vm_object_t	object,
+	vm_offset_t	start,
+	vm_offset_t	end);
+
+/*
+ *	Move the compressed data of a backing object being collapsed
+ *	into its parent.  Both objects must be locked.
+ */
+extern void vm_compress_collapse(
+	vm_object_t	object,
+	vm_object_t	backing_object,
+	vm_offset_t	backing_offset);
+
+/*
+ *	If the cache is full, write its oldest data back to the default
+ *	pager.  Called by the pageout daemon, with nothing locked.
+ */
+extern void vm_compress_balance(void);
+
+#endif	/* _VM_VM_COMPRESS_H_ */
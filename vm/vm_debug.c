@@ -415,6 +415,29 @@ mach_vm_object_pages(
 	return KERN_SUCCESS;
 }
 
+/*
+ *	Routine:	host_vm_shadow_info [kernel call]
+ *	Purpose:
+ *		Return shadow chain statistics.
+ *	Conditions:
+ *		Nothing locked.
+ *	Returns:
+ *		KERN_SUCCESS		Returned information.
+ *		KERN_INVALID_HOST	The host is null.
+ */
+
+kern_return_t
+host_vm_shadow_info(
+	host_t			host,
+	vm_shadow_info_t	*infop)
+{
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	vm_object_shadow_info(infop);
+	return KERN_SUCCESS;
+}
+
 #endif	/* MACH_VM_DEBUG */
 
 /*
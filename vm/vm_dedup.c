@@ -0,0 +1,736 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *	File:	vm/vm_dedup.c
+ *
+ *	Deduplication of anonymous memory.
+ *
+ *	A kernel thread walks the maps of all tasks, looking for resident
+ *	pages of private internal objects with the same contents.  One
+ *	copy of such contents is kept as the only page of a shared
+ *	object, and each page merged with it is replaced in its map by a
+ *	one page entry mapping the shared object copy-on-write, see
+ *	vm_map_share_page.  Writing to a merged page goes through the
+ *	usual shadow object path, so the rest of the VM system doesn't
+ *	know about deduplication.
+ *
+ *	Only pages whose checksum didn't change since the previous pass
+ *	are merged, so that pages being written aren't shared only to be
+ *	copied again right away.  The checksum is kept in the private
+ *	data of the page.  Stable pages are looked up by checksum among
+ *	the shared objects, then among the other stable pages found
+ *	during the current pass.  A page matching one of the latter gets
+ *	a shared object of its own, which the other page joins on the
+ *	next pass.  Checksums are only hints, contents are compared
+ *	before merging.
+ *
+ *	Shared objects are released at the end of a pass, once the
+ *	scanner holds their last reference.
+ *
+ *	The scanner thread is the only user of the trees, the cursor and
+ *	the workspace, which need no locking.  vm_dedup_lock protects
+ *	the tunables.
+ */
+
+#include <string.h>
+#include <mach/vm_param.h>
+#include <kern/assert.h>
+#include <kern/debug.h>
+#include <kern/host.h>
+#include <kern/lock.h>
+#include <kern/mach_clock.h>
+#include <kern/macros.h>
+#include <kern/processor.h>
+#include <kern/queue.h>
+#include <kern/rbtree.h>
+#include <kern/sched.h>
+#include <kern/sched_prim.h>
+#include <kern/slab.h>
+#include <kern/task.h>
+#include <kern/thread.h>
+#include <machine/pmap.h>
+#include <vm/pmap.h>
+#include <vm/vm_dedup.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
+#include <vm/vm_resident.h>
+
+/*
+ *	Default time between passes, in milliseconds.
+ */
+#define	VM_DEDUP_SCAN_INTERVAL	200
+
+unsigned int vm_dedup_pages_to_scan;
+unsigned int vm_dedup_scan_interval = VM_DEDUP_SCAN_INTERVAL;
+
+decl_simple_lock_data(static, vm_dedup_lock)
+
+/*
+ *	Statistics.
+ */
+unsigned long vm_dedup_pages_scanned;
+unsigned long vm_dedup_pages_shared;	/* shared objects */
+unsigned long vm_dedup_pages_sharing;	/* references to them, as of
+					   the end of the last pass */
+unsigned long vm_dedup_merges;
+
+/*
+ *	Shared object, or stable page of the current pass if object
+ *	is null, indexed by checksum.
+ */
+struct vm_dedup_node {
+	struct rbtree_node	tree_node;
+	unsigned int		checksum;
+	vm_object_t		object;
+};
+
+static struct kmem_cache vm_dedup_node_cache;
+static struct rbtree vm_dedup_shared_tree;
+static struct rbtree vm_dedup_pass_tree;
+
+/*
+ *	Position of the scanner: index of the task among those
+ *	of all processor sets, and address in its map.
+ */
+static struct {
+	unsigned int	task;
+	vm_offset_t	address;
+} vm_dedup_cursor;
+
+/*
+ *	Copies of the pages being checked, so that they don't
+ *	need to be directly mapped.
+ */
+static struct {
+	unsigned int	page[PAGE_SIZE / sizeof(unsigned int)];
+	unsigned int	shared[PAGE_SIZE / sizeof(unsigned int)];
+} vm_dedup_work __aligned(PAGE_SIZE);
+
+static inline int
+vm_dedup_cmp_lookup(
+	unsigned int		checksum,
+	const struct rbtree_node *node)
+{
+	struct vm_dedup_node *dnode;
+
+	dnode = rbtree_entry(node, struct vm_dedup_node, tree_node);
+
+	if (checksum < dnode->checksum)
+		return -1;
+	else if (checksum > dnode->checksum)
+		return 1;
+	else
+		return 0;
+}
+
+static inline int
+vm_dedup_cmp_insert(
+	const struct rbtree_node *a,
+	const struct rbtree_node *b)
+{
+	struct vm_dedup_node *dnode;
+
+	dnode = rbtree_entry(a, struct vm_dedup_node, tree_node);
+	return vm_dedup_cmp_lookup(dnode->checksum, b);
+}
+
+static inline void
+vm_dedup_read(
+	phys_addr_t	pa,
+	unsigned int	*data)
+{
+	pmap_copy_page(pa, kvtophys((vm_offset_t) data));
+}
+
+/*
+ *	FNV-1a, over words rather than bytes.
+ */
+static unsigned int
+vm_dedup_checksum(const unsigned int *data)
+{
+	unsigned int i, hash;
+
+	hash = 2166136261U;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*data); i++) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static boolean_t
+vm_dedup_entry_eligible(vm_map_entry_t entry)
+{
+	return (!entry->is_sub_map &&
+		!entry->is_shared &&
+		!entry->needs_copy &&
+		(entry->wired_count == 0) &&
+		(entry->projected_on == 0) &&
+		(entry->object.vm_object != VM_OBJECT_NULL));
+}
+
+/*
+ *	The entry must be the only way to reach the pages of the
+ *	object it maps, so that they can be taken away from it.
+ *	Merging a page clips the entry, leaving the rest of the
+ *	object referenced by several entries of the same map, so
+ *	the object may have one reference per entry of the map
+ *	mapping it, as long as no other entry maps the range of
+ *	this one.  The map must be locked.
+ */
+static boolean_t
+vm_dedup_object_eligible(
+	vm_map_t	map,
+	vm_map_entry_t	entry)
+{
+	vm_object_t object;
+	vm_map_entry_t other;
+	vm_offset_t start, end;
+	int count;
+
+	object = entry->object.vm_object;
+
+	if (!object->internal ||
+	    (object->copy != VM_OBJECT_NULL) ||
+	    (object->paging_in_progress != 0))
+		return FALSE;
+
+	if (object->ref_count == 1)
+		return TRUE;
+
+	start = entry->offset;
+	end = entry->offset + (entry->vme_end - entry->vme_start);
+	count = 0;
+
+	for (other = vm_map_first_entry(map);
+	     other != vm_map_to_entry(map);
+	     other = other->vme_next) {
+		if (other->is_sub_map ||
+		    (other->object.vm_object != object))
+			continue;
+
+		if ((other != entry) &&
+		    (other->is_shared ||
+		     ((other->offset < end) &&
+		      (other->offset + (other->vme_end - other->vme_start)
+		       > start))))
+			return FALSE;
+
+		count++;
+	}
+
+	return (count == object->ref_count);
+}
+
+static boolean_t
+vm_dedup_page_eligible(vm_page_t m)
+{
+	return (!m->busy && !m->absent && !m->error &&
+		!m->fictitious && !m->private &&
+		(m->wire_count == 0) && !m->laundry && !m->precious &&
+		(m->page_lock == VM_PROT_NONE) &&
+		(m->unlock_request == VM_PROT_NONE));
+}
+
+/*
+ *	Copy a page into the workspace and compute its checksum.
+ *	Returns TRUE if the checksum is the same as on the previous
+ *	pass.  The object of the page must be locked.
+ */
+static boolean_t
+vm_dedup_page_stable(
+	vm_page_t	m,
+	unsigned int	*checksump)
+{
+	unsigned int checksum;
+
+	vm_dedup_read(m->phys_addr, vm_dedup_work.page);
+	checksum = vm_dedup_checksum(vm_dedup_work.page);
+	*checksump = checksum;
+
+	if (vm_page_get_priv(m) == (void *) (unsigned long) checksum)
+		return TRUE;
+
+	vm_page_set_priv(m, (void *) (unsigned long) checksum);
+	return FALSE;
+}
+
+/*
+ *	Routine:	vm_dedup_object_create
+ *	Purpose:
+ *		Create a shared object holding the page in
+ *		the workspace.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static vm_object_t
+vm_dedup_object_create(void)
+{
+	vm_object_t object;
+	vm_page_t m;
+
+	m = vm_page_grab();
+	if (m == VM_PAGE_NULL)
+		return VM_OBJECT_NULL;
+
+	pmap_copy_page(kvtophys((vm_offset_t) vm_dedup_work.page),
+		       m->phys_addr);
+
+	object = vm_object_allocate(PAGE_SIZE);
+	vm_object_lock(object);
+	vm_page_lock_queues();
+	vm_page_insert(m, object, 0);
+	vm_page_activate(m);
+	vm_page_unlock_queues();
+	m->dirty = TRUE;
+	PAGE_WAKEUP_DONE(m);
+	vm_object_unlock(object);
+	return object;
+}
+
+/*
+ *	Routine:	vm_dedup_lookup
+ *	Purpose:
+ *		Return the shared object for the stable page in the
+ *		workspace, or VM_OBJECT_NULL if there is none yet.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static vm_object_t
+vm_dedup_lookup(unsigned int checksum)
+{
+	struct vm_dedup_node *node;
+	struct rbtree_node *rbnode;
+	unsigned long slot;
+	vm_object_t object;
+
+	rbnode = rbtree_lookup(&vm_dedup_shared_tree, checksum,
+			       vm_dedup_cmp_lookup);
+	if (rbnode != NULL) {
+		node = rbtree_entry(rbnode, struct vm_dedup_node, tree_node);
+		return node->object;
+	}
+
+	rbnode = rbtree_lookup_slot(&vm_dedup_pass_tree, checksum,
+				    vm_dedup_cmp_lookup, slot);
+	if (rbnode == NULL) {
+		node = (struct vm_dedup_node *)
+			kmem_cache_alloc(&vm_dedup_node_cache);
+		if (node != NULL) {
+			node->checksum = checksum;
+			node->object = VM_OBJECT_NULL;
+			rbtree_insert_slot(&vm_dedup_pass_tree, slot,
+					   &node->tree_node);
+		}
+
+		return VM_OBJECT_NULL;
+	}
+
+	/*
+	 *	Another page of this pass has the same checksum.
+	 */
+
+	object = vm_dedup_object_create();
+	if (object == VM_OBJECT_NULL)
+		return VM_OBJECT_NULL;
+
+	node = rbtree_entry(rbnode, struct vm_dedup_node, tree_node);
+	rbtree_remove(&vm_dedup_pass_tree, rbnode);
+	node->object = object;
+	rbtree_insert(&vm_dedup_shared_tree, &node->tree_node,
+		      vm_dedup_cmp_insert);
+	vm_dedup_pages_shared++;
+	return object;
+}
+
+/*
+ *	Routine:	vm_dedup_merge
+ *	Purpose:
+ *		Replace the page mapped at the given address with
+ *		the page of a shared object, if the map didn't change
+ *		since the page was found and both pages are the same.
+ *	Conditions:
+ *		Nothing locked.  timestamp is the version of the map
+ *		when the page was found.
+ */
+static void
+vm_dedup_merge(
+	vm_map_t	map,
+	vm_offset_t	address,
+	unsigned int	timestamp,
+	vm_object_t	shared_object)
+{
+	vm_map_entry_t entry;
+	vm_object_t object;
+	vm_page_t m, shared;
+	boolean_t same;
+
+	vm_map_lock(map);
+
+	if ((map->timestamp != timestamp + 1) ||
+	    !vm_map_lookup_entry(map, address, &entry) ||
+	    !vm_dedup_entry_eligible(entry)) {
+		vm_map_unlock(map);
+		return;
+	}
+
+	object = entry->object.vm_object;
+	vm_object_lock(object);
+	m = vm_page_lookup(object,
+			   entry->offset + (address - entry->vme_start));
+
+	if (!vm_dedup_object_eligible(map, entry) ||
+	    (m == VM_PAGE_NULL) || !vm_dedup_page_eligible(m) ||
+	    !vm_object_lock_try(shared_object)) {
+		vm_object_unlock(object);
+		vm_map_unlock(map);
+		return;
+	}
+
+	shared = vm_page_lookup(shared_object, 0);
+
+	if ((shared == VM_PAGE_NULL) || shared->busy ||
+	    shared->absent || shared->error) {
+		vm_object_unlock(shared_object);
+		vm_object_unlock(object);
+		vm_map_unlock(map);
+		return;
+	}
+
+	/*
+	 *	Once the page isn't mapped, it can't change until the
+	 *	map is unlocked.  The shared page never changes.
+	 */
+
+	pmap_page_protect(m->phys_addr, VM_PROT_NONE);
+	vm_dedup_read(m->phys_addr, vm_dedup_work.page);
+	vm_dedup_read(shared->phys_addr, vm_dedup_work.shared);
+	same = (memcmp(vm_dedup_work.page, vm_dedup_work.shared,
+		       PAGE_SIZE) == 0);
+
+	vm_object_unlock(shared_object);
+	vm_object_unlock(object);
+
+	if (same) {
+		vm_map_share_page(map, entry, address, shared_object);
+		vm_dedup_merges++;
+	}
+
+	vm_map_unlock(map);
+}
+
+/*
+ *	Routine:	vm_dedup_scan_map
+ *	Purpose:
+ *		Scan a map from the cursor, until its end or until
+ *		the budget of pages is spent.  Returns TRUE if the
+ *		end of the map was reached.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static boolean_t
+vm_dedup_scan_map(
+	vm_map_t	map,
+	unsigned int	*budget)
+{
+	vm_map_entry_t entry;
+	vm_object_t object, shared_object;
+	vm_offset_t address, start, end;
+	unsigned int checksum, timestamp;
+	vm_page_t m;
+
+restart:
+	vm_map_lock_read(map);
+
+	if (!vm_map_lookup_entry(map, vm_dedup_cursor.address, &entry))
+		entry = entry->vme_next;
+
+	for (; entry != vm_map_to_entry(map); entry = entry->vme_next) {
+		if (!vm_dedup_entry_eligible(entry))
+			continue;
+
+		object = entry->object.vm_object;
+		start = entry->offset;
+		end = entry->offset + (entry->vme_end - entry->vme_start);
+
+		if (vm_dedup_cursor.address > entry->vme_start)
+			start += vm_dedup_cursor.address - entry->vme_start;
+
+		vm_object_lock(object);
+
+		if (!vm_dedup_object_eligible(map, entry)) {
+			vm_object_unlock(object);
+			continue;
+		}
+
+		for (m = vm_page_lookup_range(object, start, end);
+		     m != VM_PAGE_NULL;
+		     m = vm_page_next_range(m, end)) {
+			address = entry->vme_start + (m->offset - entry->offset);
+
+			if (*budget == 0) {
+				vm_dedup_cursor.address = address;
+				vm_object_unlock(object);
+				vm_map_unlock_read(map);
+				return FALSE;
+			}
+
+			(*budget)--;
+			vm_dedup_pages_scanned++;
+
+			if (!vm_dedup_page_eligible(m) ||
+			    !vm_dedup_page_stable(m, &checksum))
+				continue;
+
+			vm_dedup_cursor.address = address + PAGE_SIZE;
+			vm_object_unlock(object);
+			timestamp = map->timestamp;
+			vm_map_unlock_read(map);
+
+			shared_object = vm_dedup_lookup(checksum);
+
+			if (shared_object != VM_OBJECT_NULL)
+				vm_dedup_merge(map, address, timestamp,
+					       shared_object);
+
+			goto restart;
+		}
+
+		vm_object_unlock(object);
+	}
+
+	vm_map_unlock_read(map);
+	return TRUE;
+}
+
+/*
+ *	Routine:	vm_dedup_task
+ *	Purpose:
+ *		Return the task at the given index among those of
+ *		all processor sets, with a new reference, or
+ *		TASK_NULL past the last one.
+ */
+static task_t
+vm_dedup_task(unsigned int index)
+{
+	processor_set_t pset;
+	task_t task;
+
+	simple_lock(&all_psets_lock);
+	queue_iterate(&all_psets, pset, processor_set_t, all_psets) {
+		pset_lock(pset);
+
+		if (index < pset->task_count) {
+			queue_iterate(&pset->tasks, task, task_t, pset_tasks) {
+				if (index-- == 0)
+					break;
+			}
+
+			task_reference(task);
+			pset_unlock(pset);
+			simple_unlock(&all_psets_lock);
+			return task;
+		}
+
+		index -= pset->task_count;
+		pset_unlock(pset);
+	}
+	simple_unlock(&all_psets_lock);
+
+	return TASK_NULL;
+}
+
+/*
+ *	Routine:	vm_dedup_pass_end
+ *	Purpose:
+ *		Forget the stable pages of the pass, release shared
+ *		objects which are no longer mapped, and count the
+ *		references to the others.
+ */
+static void
+vm_dedup_pass_end(void)
+{
+	struct vm_dedup_node *node;
+	struct rbtree_node *rbnode, *tmp;
+	unsigned long sharing;
+	vm_object_t object;
+	int ref_count;
+
+	rbtree_for_each_remove(&vm_dedup_pass_tree, rbnode, tmp) {
+		node = rbtree_entry(rbnode, struct vm_dedup_node, tree_node);
+		kmem_cache_free(&vm_dedup_node_cache, (vm_offset_t) node);
+	}
+
+	rbtree_init(&vm_dedup_pass_tree);
+
+	sharing = 0;
+	rbnode = rbtree_first(&vm_dedup_shared_tree);
+
+	while (rbnode != NULL) {
+		tmp = rbtree_next(rbnode);
+		node = rbtree_entry(rbnode, struct vm_dedup_node, tree_node);
+		object = node->object;
+
+		vm_object_lock(object);
+		ref_count = object->ref_count;
+		vm_object_unlock(object);
+
+		if (ref_count == 1) {
+			rbtree_remove(&vm_dedup_shared_tree, rbnode);
+			kmem_cache_free(&vm_dedup_node_cache,
+					(vm_offset_t) node);
+			vm_object_deallocate(object);
+			vm_dedup_pages_shared--;
+		} else {
+			sharing += ref_count - 1;
+		}
+
+		rbnode = tmp;
+	}
+
+	vm_dedup_pages_sharing = sharing;
+}
+
+/*
+ *	Routine:	vm_dedup_scan
+ *	Purpose:
+ *		Scan up to the given number of resident pages, from
+ *		the cursor.  Ends the pass after the last task.
+ */
+static void
+vm_dedup_scan(unsigned int budget)
+{
+	boolean_t done;
+	task_t task;
+
+	while (budget != 0) {
+		task = vm_dedup_task(vm_dedup_cursor.task);
+
+		if (task == TASK_NULL) {
+			vm_dedup_pass_end();
+			vm_dedup_cursor.task = 0;
+			vm_dedup_cursor.address = 0;
+			return;
+		}
+
+		if (task->map == kernel_map)
+			done = TRUE;
+		else
+			done = vm_dedup_scan_map(task->map, &budget);
+
+		task_deallocate(task);
+
+		if (done) {
+			vm_dedup_cursor.task++;
+			vm_dedup_cursor.address = 0;
+		}
+	}
+}
+
+void
+vm_dedup_init(void)
+{
+	simple_lock_init(&vm_dedup_lock);
+	kmem_cache_init(&vm_dedup_node_cache, "vm_dedup_node",
+			sizeof(struct vm_dedup_node), 0, NULL, 0);
+	rbtree_init(&vm_dedup_shared_tree);
+	rbtree_init(&vm_dedup_pass_tree);
+}
+
+void
+vm_dedup_thread(void)
+{
+	unsigned int pages_to_scan, ticks;
+
+	thread_set_own_priority(BASEPRI_USER);
+
+	for (;;) {
+		simple_lock(&vm_dedup_lock);
+		pages_to_scan = vm_dedup_pages_to_scan;
+		simple_unlock(&vm_dedup_lock);
+
+		if (pages_to_scan != 0)
+			vm_dedup_scan(pages_to_scan);
+
+		simple_lock(&vm_dedup_lock);
+		assert_wait((event_t) &vm_dedup_pages_to_scan, FALSE);
+
+		if (vm_dedup_pages_to_scan != 0) {
+			ticks = vm_dedup_scan_interval * hz / 1000;
+			thread_set_timeout((ticks == 0) ? 1 : ticks);
+		}
+
+		simple_unlock(&vm_dedup_lock);
+		thread_block(NULL);
+	}
+}
+
+/*
+ *	Routine:	vm_dedup_set [kernel call]
+ *	Purpose:
+ *		Set the number of pages scanned on each pass, which
+ *		disables the scanner when zero, and the time between
+ *		passes in milliseconds.
+ *	Conditions:
+ *		Nothing locked.
+ */
+kern_return_t
+vm_dedup_set(
+	host_t		host,
+	natural_t	pages_to_scan,
+	natural_t	scan_interval)
+{
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	simple_lock(&vm_dedup_lock);
+	vm_dedup_pages_to_scan = pages_to_scan;
+	vm_dedup_scan_interval = scan_interval;
+	simple_unlock(&vm_dedup_lock);
+
+	thread_wakeup((event_t) &vm_dedup_pages_to_scan);
+	return KERN_SUCCESS;
+}
+
+/*
+ *	Routine:	vm_dedup_info [kernel call]
+ *	Purpose:
+ *		Return the number of pages scanned, and how many
+ *		shared pages replace how many private ones.
+ *	Conditions:
+ *		Nothing locked.
+ */
+kern_return_t
+vm_dedup_info(
+	host_t		host,
+	natural_t	*pages_scanned,
+	natural_t	*pages_shared,
+	natural_t	*pages_sharing)
+{
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	*pages_scanned = vm_dedup_pages_scanned;
+	*pages_shared = vm_dedup_pages_shared;
+	*pages_sharing = vm_dedup_pages_sharing;
+	return KERN_SUCCESS;
+}
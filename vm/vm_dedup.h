@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Free Software Foundation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VM_VM_DEDUP_H_
+#define _VM_VM_DEDUP_H_
+
+#include <mach/kern_return.h>
+#include <mach/machine/vm_types.h>
+#include <kern/host.h>
+
+/*
+ *	Number of pages examined on each pass, zero when the scanner
+ *	is disabled, and time between passes in milliseconds.
+ */
+extern unsigned int vm_dedup_pages_to_scan;
+extern unsigned int vm_dedup_scan_interval;
+
+extern void vm_dedup_init(void);
+extern void vm_dedup_thread(void);
+
+extern kern_return_t vm_dedup_set(
+	host_t		host,
+	natural_t	pages_to_scan,
+	natural_t	scan_interval);
+
+extern kern_return_t vm_dedup_info(
+	host_t		host,
+	natural_t	*pages_scanned,
+	natural_t	*pages_shared,
+	natural_t	*pages_sharing);
+
+#endif	/* _VM_VM_DEDUP_H_ */
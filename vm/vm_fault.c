@@ -41,6 +41,7 @@
 #include <kern/debug.h>
 #include <kern/thread.h>
 #include <kern/sched_prim.h>
+#include <vm/vm_compress.h>
 #include <vm/vm_map.h>
 #include <vm/vm_object.h>
 #include <vm/vm_page.h>
@@ -93,6 +94,26 @@ boolean_t	vm_fault_interruptible = TRUE;
 
 boolean_t	software_reference_bits = TRUE;
 
+/*
+ *	Fault-around: once a fault is resolved, the resident pages
+ *	of the same object within an aligned window of
+ *	vm_fault_around_window pages around the faulting address
+ *	are mapped read-only as well.  The window must be a power
+ *	of two; 0 or 1 disables fault-around.
+ */
+unsigned int	vm_fault_around_window = 16;
+unsigned int	vm_fault_around_count;	/* pages mapped by fault-around */
+
+/*
+ *	Clustered pagein: while the data requests for an object are
+ *	sequential, each one asks for twice as many pages as the
+ *	previous one, up to the cluster size set by the memory manager
+ *	and vm_fault_cluster_max.  The pages following the faulting
+ *	one are entered inactive when the data is supplied.
+ */
+vm_size_t	vm_fault_cluster_max = 64 * 1024;
+unsigned int	vm_fault_cluster_count;	/* pages requested ahead */
+
 #if	MACH_KDB
 extern struct db_watchpoint *db_watchpoint_list;
 #endif	/* MACH_KDB */
@@ -163,6 +184,55 @@ vm_fault_cleanup(
 
 
 
+/*
+ *	Routine:	vm_fault_cluster
+ *	Purpose:
+ *		Return the size of the data request for the absent
+ *		page at "offset" in "object", and record the request
+ *		for sequential access detection.  The request covers
+ *		that page and the following ones that aren't resident,
+ *		up to the end of the object.
+ *	In/out conditions:
+ *		"object" must be locked.
+ */
+static vm_size_t
+vm_fault_cluster(
+	vm_object_t	object,
+	vm_offset_t	offset)
+{
+	vm_size_t	max_size, size;
+	vm_offset_t	end, limit;
+	unsigned int	i;
+
+	if (offset == object->pagein_next) {
+		if (object->pagein_run < 32)
+			object->pagein_run++;
+	} else
+		object->pagein_run = 0;
+
+	max_size = object->cluster_size;
+	if (max_size > vm_fault_cluster_max)
+		max_size = trunc_page(vm_fault_cluster_max);
+
+	size = PAGE_SIZE;
+	for (i = 0; (i < object->pagein_run) && (size < max_size); i++)
+		size <<= 1;
+	if (size > max_size)
+		size = max_size;
+
+	limit = round_page(object->size);
+
+	for (end = offset + PAGE_SIZE;
+	     (end > offset) && (end < offset + size) && (end < limit);
+	     end += PAGE_SIZE)
+		if (vm_page_lookup(object, end) != VM_PAGE_NULL)
+			break;
+
+	object->pagein_next = end;
+	vm_fault_cluster_count += atop(end - offset) - 1;
+	return end - offset;
+}
+
 /*
  *	Routine:	vm_fault_page
  *	Purpose:
@@ -227,7 +297,15 @@ vm_fault_return_t vm_fault_page(
 	vm_object_t	next_object;
 	vm_object_t	copy_object;
 	boolean_t	look_for_page;
+	boolean_t	zeroed;
 	vm_prot_t	access_required;
+	unsigned int	depth;
+
+	/*
+	 *	Number of shadow objects walked, counted from
+	 *	where a restarted fault left off.
+	 */
+	depth = 0;
 
 	if (resume) {
 		vm_fault_state_t *state =
@@ -423,7 +501,7 @@ vm_fault_return_t vm_fault_page(
 					 * need to allocate a real page.
 					 */
 
-					real_m = vm_page_grab();
+					real_m = vm_page_grab_zeroed(&zeroed);
 					if (real_m == VM_PAGE_NULL) {
 						vm_fault_cleanup(object, first_m);
 						return(VM_FAULT_MEMORY_SHORTAGE);
@@ -458,7 +536,8 @@ vm_fault_return_t vm_fault_page(
 					 */
 					vm_object_unlock(object);
 
-					vm_page_zero_fill(m);
+					if (!zeroed)
+						vm_page_zero_fill(m);
 
 					vm_stat_sample(SAMPLED_PC_VM_ZFILL_FAULTS);
 
@@ -487,6 +566,7 @@ vm_fault_return_t vm_fault_page(
 					vm_object_unlock(object);
 					object = next_object;
 					vm_object_paging_begin(object);
+					depth++;
 					continue;
 				}
 			}
@@ -586,6 +666,7 @@ vm_fault_return_t vm_fault_page(
 
 		if (look_for_page && !must_be_resident) {
 			kern_return_t	rc;
+			vm_size_t	length;
 
 			/*
 			 *	If the memory manager is not ready, we
@@ -612,6 +693,7 @@ vm_fault_return_t vm_fault_page(
 					vm_fault_cleanup(object, first_m);
 					return(VM_FAULT_MEMORY_SHORTAGE);
 				}
+				length = PAGE_SIZE;
 			} else if (object->absent_count >
 						vm_object_absent_max) {
 				/*
@@ -623,6 +705,20 @@ vm_fault_return_t vm_fault_page(
 				vm_object_absent_assert_wait(object, interruptible);
 				VM_PAGE_FREE(m);
 				goto block_and_backoff;
+			} else
+				length = vm_fault_cluster(object, offset);
+
+			vm_page_refault(object, offset);
+
+			/*
+			 *	Internal pages may have been compressed
+			 *	instead of paged out.  Once filled, the
+			 *	page is found again by the next lookup.
+			 */
+
+			if (object->internal && vm_compress_fault(m)) {
+				PAGE_WAKEUP_DONE(m);
+				continue;
 			}
 
 			/*
@@ -650,14 +746,15 @@ vm_fault_return_t vm_fault_page(
 			if ((rc = memory_object_data_request(object->pager,
 				object->pager_request,
 				m->offset + object->paging_offset,
-				PAGE_SIZE, access_required)) != KERN_SUCCESS) {
+				length, access_required)) != KERN_SUCCESS) {
 				if (object->pager && rc != MACH_SEND_INTERRUPTED)
-					printf("%s(0x%p, 0x%p, 0x%lx, 0x%x, 0x%x) failed, %x\n",
+					printf("%s(0x%p, 0x%p, 0x%lx, 0x%lx, 0x%x) failed, %x\n",
 						"memory_object_data_request",
 						object->pager,
 						object->pager_request,
 						m->offset + object->paging_offset,
-						PAGE_SIZE, access_required, rc);
+						(unsigned long) length,
+						access_required, rc);
 				/*
 				 *	Don't want to leave a busy page around,
 				 *	but the data request may have blocked,
@@ -725,14 +822,32 @@ vm_fault_return_t vm_fault_page(
 			assert(m->object == object);
 			first_m = VM_PAGE_NULL;
 
-			if (m->fictitious && !vm_page_convert(&m)) {
+			/*
+			 *	Replace the placeholder with a real page,
+			 *	preferably one already filled with zeros.
+			 */
+			zeroed = FALSE;
+			if (m->fictitious) {
+				vm_page_t real_m;
+
+				real_m = vm_page_grab_zeroed(&zeroed);
+				if (real_m == VM_PAGE_NULL) {
+					VM_PAGE_FREE(m);
+					vm_fault_cleanup(object, VM_PAGE_NULL);
+					return(VM_FAULT_MEMORY_SHORTAGE);
+				}
+
 				VM_PAGE_FREE(m);
-				vm_fault_cleanup(object, VM_PAGE_NULL);
-				return(VM_FAULT_MEMORY_SHORTAGE);
+				assert(real_m->busy);
+				vm_page_lock_queues();
+				vm_page_insert(real_m, object, offset);
+				vm_page_unlock_queues();
+				m = real_m;
 			}
 
 			vm_object_unlock(object);
-			vm_page_zero_fill(m);
+			if (!zeroed)
+				vm_page_zero_fill(m);
 			vm_stat_sample(SAMPLED_PC_VM_ZFILL_FAULTS);
 			vm_stat.zero_fill_count++;
 			current_task()->zero_fills++;
@@ -747,6 +862,7 @@ vm_fault_return_t vm_fault_page(
 			vm_object_unlock(object);
 			object = next_object;
 			vm_object_paging_begin(object);
+			depth++;
 		}
 	}
 
@@ -773,6 +889,8 @@ vm_fault_return_t vm_fault_page(
 		(first_m->busy && !first_m->absent &&
 		 !first_m->active && !first_m->inactive));
 
+	vm_object_shadow_depth(first_object, depth);
+
 	/*
 	 *	If the page is being written, but isn't
 	 *	already owned by the top-level object,
@@ -1109,6 +1227,80 @@ vm_fault_return_t vm_fault_page(
 #undef	RELEASE_PAGE
 }
 
+/*
+ *	Routine:	vm_fault_around
+ *	Purpose:
+ *		Enter read-only mappings for the resident pages
+ *		of the object around a resolved fault, so that
+ *		accesses to neighbouring pages don't fault.
+ *		Pages that are busy, being cleaned, or already
+ *		mapped at their address are left alone.
+ *	In/out conditions:
+ *		The map is locked, as by vm_map_verify.
+ *		"object" is the object of the map entry at
+ *		"vaddr", with "offset" the offset of that address.
+ *		It is locked and has a paging reference; the lock
+ *		is released and reacquired.
+ */
+static void
+vm_fault_around(
+	vm_map_t	map,
+	vm_offset_t	vaddr,
+	vm_object_t	object,
+	vm_offset_t	offset,
+	vm_prot_t	prot)
+{
+	vm_map_entry_t	entry;
+	vm_offset_t	start, end, va;
+	vm_size_t	window;
+	vm_page_t	p;
+
+	window = vm_fault_around_window * PAGE_SIZE;
+	prot &= ~VM_PROT_WRITE;
+	if ((window <= PAGE_SIZE) || (window & (window - 1)) ||
+	    (prot == VM_PROT_NONE))
+		return;
+
+	if (!vm_map_lookup_entry(map, vaddr, &entry) ||
+	    entry->is_sub_map ||
+	    (entry->object.vm_object != object) ||
+	    (entry->wired_count != 0))
+		return;
+
+	start = vaddr & ~(window - 1);
+	end = start + window;
+	if (start < entry->vme_start)
+		start = entry->vme_start;
+	if ((end > entry->vme_end) || (end < start))
+		end = entry->vme_end;
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		if (va == vaddr)
+			continue;
+
+		p = vm_page_lookup(object, offset + (va - vaddr));
+		if ((p == VM_PAGE_NULL) || p->busy || p->absent ||
+		    p->error || p->fictitious || p->laundry ||
+		    (p->page_lock & VM_PROT_READ))
+			continue;
+
+		if (pmap_extract(map->pmap, va) != 0)
+			continue;
+
+		/*
+		 *	pmap_enter may block: hold the page busy
+		 *	rather than the object locked.
+		 */
+
+		p->busy = TRUE;
+		vm_object_unlock(object);
+		PMAP_ENTER(map->pmap, va, p, prot, FALSE);
+		vm_object_lock(object);
+		PAGE_WAKEUP_DONE(p);
+		vm_fault_around_count++;
+	}
+}
+
 /*
  *	Routine:	vm_fault
  *	Purpose:
@@ -1463,6 +1655,14 @@ kern_return_t vm_fault(
 	}
 	vm_page_unlock_queues();
 
+	/*
+	 *	Map the resident neighbours of the page, if it
+	 *	came from the object of the entry.
+	 */
+
+	if (!change_wiring && !wired && (m->object == object))
+		vm_fault_around(map, vaddr, object, offset, prot);
+
 	/*
 	 *	Unlock everything, and return
 	 */
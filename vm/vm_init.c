@@ -44,6 +44,9 @@
 #include <vm/vm_kern.h>
 #include <vm/memory_object.h>
 #include <vm/memory_object_proxy.h>
+#include <vm/vm_channel.h>
+#include <vm/vm_compress.h>
+#include <vm/vm_dedup.h>
 
 
 /*
@@ -83,5 +86,8 @@ void vm_mem_init(void)
 {
 	vm_object_init();
 	memory_object_proxy_init();
+	vm_channel_init();
+	vm_compress_init();
+	vm_dedup_init();
 	vm_page_info_all();
 }
@@ -41,6 +41,7 @@
 #include <mach/vm_param.h>
 #include <mach/vm_wire.h>
 #include <kern/assert.h>
+#include <kern/atomic.h>
 #include <kern/debug.h>
 #include <kern/kalloc.h>
 #include <kern/list.h>
@@ -197,7 +198,6 @@ void vm_map_setup(
 	map->name = NULL;
 	vm_map_lock_init(map);
 	simple_lock_init(&map->ref_lock);
-	simple_lock_init(&map->hint_lock);
 }
 
 /*
@@ -562,12 +562,89 @@ void vm_map_deallocate(vm_map_t map)
  *	SAVE_HINT:
  *
  *	Saves the specified entry as the hint for
- *	future lookups.  Performs necessary interlocks.
+ *	future lookups.  The hint is read and written
+ *	atomically, so that readers of the map don't
+ *	serialize on it.
  */
 #define	SAVE_HINT(map,value) \
-		simple_lock(&(map)->hint_lock); \
-		(map)->hint = (value); \
-		simple_unlock(&(map)->hint_lock);
+		atomic_store_rlx(&(map)->hint, (value))
+
+/*
+ *	vm_map_cache_lookup:
+ *
+ *	Looks for the entry containing the specified address
+ *	among those the current thread recently found in the
+ *	map of its task.  They are only valid as long as the
+ *	map timestamp is the one they were saved with, i.e.
+ *	as long as no writer has locked the map since.
+ *
+ *	The map must be locked.
+ */
+static inline vm_map_entry_t vm_map_cache_lookup(
+	vm_map_t	map,
+	vm_offset_t	address)
+{
+	thread_t	thread = current_thread();
+	vm_map_entry_t	entry;
+	int		i;
+
+	if ((thread == THREAD_NULL) ||
+	    (thread->task == TASK_NULL) ||
+	    (thread->task->map != map) ||
+	    (thread->vm_map_cache_timestamp != map->timestamp))
+		return VM_MAP_ENTRY_NULL;
+
+	for (i = 0; i < THREAD_VM_MAP_CACHE; i++) {
+		entry = thread->vm_map_cache[i];
+		if ((entry != VM_MAP_ENTRY_NULL) &&
+		    (address >= entry->vme_start) &&
+		    (address < entry->vme_end))
+			return entry;
+	}
+
+	return VM_MAP_ENTRY_NULL;
+}
+
+/*
+ *	vm_map_cache_save:
+ *
+ *	Remembers an entry found by the current thread in the
+ *	map of its task.
+ *
+ *	The map must be locked.
+ */
+static inline void vm_map_cache_save(
+	vm_map_t	map,
+	vm_map_entry_t	entry)
+{
+	thread_t	thread = current_thread();
+	int		i;
+
+	if ((thread == THREAD_NULL) ||
+	    (thread->task == TASK_NULL) ||
+	    (thread->task->map != map))
+		return;
+
+	/*
+	 *	A writer may free the entries it finds before it
+	 *	unlocks the map, without any further timestamp
+	 *	change, so only remember entries found by readers.
+	 */
+
+	if (map->lock.want_write || map->lock.want_upgrade)
+		return;
+
+	if (thread->vm_map_cache_timestamp != map->timestamp) {
+		for (i = 0; i < THREAD_VM_MAP_CACHE; i++)
+			thread->vm_map_cache[i] = VM_MAP_ENTRY_NULL;
+		thread->vm_map_cache_timestamp = map->timestamp;
+		thread->vm_map_cache_next = 0;
+	}
+
+	thread->vm_map_cache[thread->vm_map_cache_next] = entry;
+	thread->vm_map_cache_next = (thread->vm_map_cache_next + 1)
+				    % THREAD_VM_MAP_CACHE;
+}
 
 /*
  *	vm_map_lookup_entry:	[ internal use only ]
@@ -588,16 +665,26 @@ boolean_t vm_map_lookup_entry(
 	vm_map_entry_t		hint;
 
 	/*
-	 *	First, make a quick check to see if we are already
+	 *	First, check the entries this thread recently used,
+	 *	which doesn't touch any data shared with other threads.
+	 */
+
+	hint = vm_map_cache_lookup(map, address);
+	if (hint != VM_MAP_ENTRY_NULL) {
+		*entry = hint;
+		return(TRUE);
+	}
+
+	/*
+	 *	Then make a quick check to see if we are already
 	 *	looking at the entry we want (which is often the case).
 	 */
 
-	simple_lock(&map->hint_lock);
-	hint = map->hint;
-	simple_unlock(&map->hint_lock);
+	hint = atomic_load_rlx(&map->hint);
 
 	if ((hint != vm_map_to_entry(map)) && (address >= hint->vme_start)) {
 		if (address < hint->vme_end) {
+			vm_map_cache_save(map, hint);
 			*entry = hint;
 			return(TRUE);
 		} else {
@@ -620,13 +707,23 @@ boolean_t vm_map_lookup_entry(
 
 	if (node == NULL) {
 		*entry = vm_map_to_entry(map);
-		SAVE_HINT(map, *entry);
-		return(FALSE);
 	} else {
 		*entry = rbtree_entry(node, struct vm_map_entry, tree_node);
-		SAVE_HINT(map, *entry);
-		return((address < (*entry)->vme_end) ? TRUE : FALSE);
 	}
+
+	/*
+	 *	Avoid writing the hint if it doesn't change, so that
+	 *	its cache line stays shared between processors.
+	 */
+
+	if (*entry != hint)
+		SAVE_HINT(map, *entry);
+
+	if ((node == NULL) || (address >= (*entry)->vme_end))
+		return(FALSE);
+
+	vm_map_cache_save(map, *entry);
+	return(TRUE);
 }
 
 /*
@@ -1941,6 +2038,37 @@ kern_return_t vm_map_delete(
 	if (map->first_free->vme_start >= start)
 		map->first_free = entry->vme_prev;
 
+	/*
+	 *	Remove the mappings of private entries first, in one
+	 *	batch, so that other processors are signalled once for
+	 *	the whole region.  This must be done before any object
+	 *	is deallocated below, as that may free pages.  Entries
+	 *	needing more care are left to vm_map_entry_delete.
+	 */
+
+	if (vm_map_pmap(map) != kernel_pmap) {
+		vm_map_entry_t	tmp_entry;
+
+		PMAP_BATCH_BEGIN();
+		for (tmp_entry = entry;
+		     (tmp_entry != vm_map_to_entry(map)) &&
+		     (tmp_entry->vme_start < end);
+		     tmp_entry = tmp_entry->vme_next) {
+			if (tmp_entry->in_transition ||
+			    tmp_entry->is_sub_map ||
+			    tmp_entry->is_shared ||
+			    (tmp_entry->wired_count != 0) ||
+			    (tmp_entry->projected_on != 0) ||
+			    (tmp_entry->object.vm_object == VM_OBJECT_NULL))
+				continue;
+
+			pmap_remove(map->pmap, tmp_entry->vme_start,
+				    (tmp_entry->vme_end < end) ?
+				    tmp_entry->vme_end : end);
+		}
+		PMAP_BATCH_END();
+	}
+
 	/*
 	 *	Step through all entries in this region
 	 */
@@ -2659,6 +2787,77 @@ vm_map_copy_insert(struct vm_map *map, struct vm_map_entry *where,
 	kmem_cache_free(&vm_map_copy_cache, (vm_offset_t)copy);
 }
 
+boolean_t vm_map_copyout_premap_enable = TRUE;
+
+/*
+ *	Routine:	vm_map_copyout_premap
+ *
+ *	Description:
+ *		Enter the resident pages of a copy entry into the
+ *		destination pmap, if the entry owns its object outright.
+ *
+ *		This is the case when the data was moved out of the
+ *		source map (see the src_destroy case in vm_map_copyin)
+ *		or copied into a fresh object.  Nobody else can see the
+ *		pages, so they can be mapped with the entry protection
+ *		right away, sparing the receiver a fault per page.
+ *
+ *	In/out conditions:
+ *		The destination map is locked.  The entry is
+ *		not linked in yet.
+ */
+static void
+vm_map_copyout_premap(
+	vm_map_t	map,
+	vm_map_entry_t	entry)
+{
+	vm_object_t	object;
+	vm_offset_t	offset;
+	vm_offset_t	va;
+	vm_page_t	m;
+
+	object = entry->object.vm_object;
+	if (!vm_map_copyout_premap_enable ||
+	    entry->is_sub_map || entry->needs_copy ||
+	    (entry->wired_count != 0) ||
+	    (object == VM_OBJECT_NULL))
+		return;
+
+	vm_object_lock(object);
+	if (!object->temporary || object->use_shared_copy ||
+	    (object->ref_count != 1) ||
+	    (object->copy != VM_OBJECT_NULL)) {
+		vm_object_unlock(object);
+		return;
+	}
+	vm_object_paging_begin(object);
+
+	offset = entry->offset;
+	for (va = entry->vme_start; va < entry->vme_end;
+	     va += PAGE_SIZE, offset += PAGE_SIZE) {
+		m = vm_page_lookup(object, offset);
+		if ((m == VM_PAGE_NULL) || m->busy || m->absent ||
+		    m->error || m->fictitious ||
+		    (m->page_lock != VM_PROT_NONE))
+			continue;
+
+		m->busy = TRUE;
+		vm_object_unlock(object);
+
+		PMAP_ENTER(map->pmap, va, m, entry->protection, FALSE);
+
+		vm_object_lock(object);
+		PAGE_WAKEUP_DONE(m);
+		vm_page_lock_queues();
+		if (!m->active && !m->inactive)
+		    vm_page_activate(m);
+		vm_page_unlock_queues();
+	}
+
+	vm_object_paging_end(object);
+	vm_object_unlock(object);
+}
+
 /*
  *	Routine:	vm_map_copyout
  *
@@ -2755,7 +2954,10 @@ kern_return_t vm_map_copyout(
 		 * If the entry is now wired,
 		 * map the pages into the destination map.
 		 */
-		if (entry->wired_count != 0) {
+		if (entry->wired_count == 0) {
+		    if (!dst_map->wiring_required)
+			vm_map_copyout_premap(dst_map, entry);
+		} else {
 		    vm_offset_t 	va;
 		    vm_offset_t		offset;
 		    vm_object_t 	object;
@@ -3383,8 +3585,23 @@ kern_return_t vm_map_copyin(
 		     * copy-on-write only if the source is.
 		     * We make another reference to the object, because
 		     * destroying the source entry will deallocate it.
+		     *
+		     * If the source entry is copy-on-write but holds
+		     * the only reference to its object, whoever it was
+		     * sharing the object with is gone, and the copy can
+		     * take the object over without a pending copy.  This
+		     * lets vm_map_copyout map the pages directly.
 		     */
-		    vm_object_reference(src_object);
+		    if (src_object != VM_OBJECT_NULL) {
+			vm_object_lock(src_object);
+			if (new_entry->needs_copy &&
+			    (src_object->ref_count == 1) &&
+			    (src_object->copy == VM_OBJECT_NULL))
+				new_entry->needs_copy = FALSE;
+			assert(src_object->ref_count > 0);
+			src_object->ref_count++;
+			vm_object_unlock(src_object);
+		    }
 
 		    /*
 		     * Copy is always unwired.  vm_map_copy_entry
@@ -4535,27 +4752,13 @@ kern_return_t vm_map_lookup(
 		}
 
 	/*
-	 *	If the map has an interesting hint, try it before calling
-	 *	full blown lookup routine.
+	 *	vm_map_lookup_entry tries the entries recently used
+	 *	by this thread and the map hint before the full blown
+	 *	lookup.
 	 */
 
-	simple_lock(&map->hint_lock);
-	entry = map->hint;
-	simple_unlock(&map->hint_lock);
-
-	if ((entry == vm_map_to_entry(map)) ||
-	    (vaddr < entry->vme_start) || (vaddr >= entry->vme_end)) {
-		vm_map_entry_t	tmp_entry;
-
-		/*
-		 *	Entry was either not a valid hint, or the vaddr
-		 *	was not contained in the entry, so do a full lookup.
-		 */
-		if (!vm_map_lookup_entry(map, vaddr, &tmp_entry))
-			RETURN(KERN_INVALID_ADDRESS);
-
-		entry = tmp_entry;
-	}
+	if (!vm_map_lookup_entry(map, vaddr, &entry))
+		RETURN(KERN_INVALID_ADDRESS);
 
 	/*
 	 *	Handle submaps.
@@ -4831,6 +5034,52 @@ void vm_map_simplify(
 	vm_map_unlock(map);
 }
 
+/*
+ *	Routine:	vm_map_share_page
+ *	Purpose:
+ *		Replace the page mapped at the given address by the
+ *		first page of object, which is mapped copy-on-write.
+ *		The page is removed from the object of the entry.
+ *	Conditions:
+ *		The map is locked for writing, and the entry contains
+ *		the address.  The entry must hold the only reference
+ *		to its object, and must be neither shared, wired nor
+ *		copy-on-write.  The caller has made sure the contents
+ *		of both pages are the same.
+ */
+void vm_map_share_page(
+	vm_map_t	map,
+	vm_map_entry_t	entry,
+	vm_offset_t	address,
+	vm_object_t	object)
+{
+	vm_object_t	old_object;
+	vm_offset_t	offset;
+
+	assert(!entry->is_shared && !entry->is_sub_map);
+	assert(!entry->needs_copy && (entry->wired_count == 0));
+
+	vm_map_clip_start(map, entry, address);
+	vm_map_clip_end(map, entry, address + PAGE_SIZE);
+
+	/*
+	 *	Only this entry maps the page, so nothing
+	 *	can see it once the entry is redirected.
+	 */
+
+	old_object = entry->object.vm_object;
+	offset = entry->offset;
+	vm_object_lock(old_object);
+	vm_object_page_remove(old_object, offset, offset + PAGE_SIZE);
+	vm_object_unlock(old_object);
+
+	vm_object_reference(object);
+	entry->object.vm_object = object;
+	entry->offset = 0;
+	entry->needs_copy = TRUE;
+	vm_object_deallocate(old_object);
+}
+
 
 /*
  *	Routine:	vm_map_machine_attribute
@@ -170,11 +170,13 @@ struct vm_map_header {
  *	Implementation:
  *		Maps are doubly-linked lists of map entries, sorted
  *		by address.  They're also contained in a red-black tree.
- *		One hint is used to start searches again at the last
- *		successful search, insertion, or removal.  If the hint
- *		lookup failed (i.e. the hint didn't refer to the requested
- *		entry), a BST lookup is performed.  Another hint is used to
- *		quickly find free space.
+ *		Each thread remembers the last few entries it found in
+ *		the map of its task, for as long as the map timestamp
+ *		doesn't change.  One hint, shared by all threads, is used
+ *		to start searches again at the last successful search,
+ *		insertion, or removal.  If neither of them refers to the
+ *		requested entry, a BST lookup is performed.  Another hint
+ *		is used to quickly find free space.
  */
 struct vm_map {
 	lock_data_t		lock;		/* Lock for map data */
@@ -186,8 +188,8 @@ struct vm_map {
 	vm_size_t		size_wired;	/* wired size */
 	int			ref_count;	/* Reference count */
 	decl_simple_lock_data(,	ref_lock)	/* Lock for ref_count field */
-	vm_map_entry_t		hint;		/* hint for quick lookups */
-	decl_simple_lock_data(,	hint_lock)	/* lock for hint storage */
+	vm_map_entry_t		hint;		/* hint for quick lookups,
+						   updated atomically */
 	vm_map_entry_t		first_free;	/* First free space hint */
 
 	/* Flags */
@@ -447,6 +449,10 @@ extern kern_return_t	vm_map_machine_attribute(vm_map_t, vm_offset_t,
 extern kern_return_t	vm_map_msync(vm_map_t,
 				     vm_offset_t, vm_size_t, vm_sync_t);
 
+/* Map a shared page copy-on-write in place of a private one */
+extern void		vm_map_share_page(vm_map_t, vm_map_entry_t,
+					  vm_offset_t, vm_object_t);
+
 /* Delete entry from map */
 extern void		vm_map_entry_delete(vm_map_t, vm_map_entry_t);
 
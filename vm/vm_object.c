@@ -45,11 +45,15 @@
 #include <kern/assert.h>
 #include <kern/debug.h>
 #include <kern/lock.h>
+#include <kern/mach_clock.h>
 #include <kern/queue.h>
+#include <kern/sched.h>
+#include <kern/sched_prim.h>
 #include <kern/xpr.h>
 #include <kern/slab.h>
 #include <vm/memory_object.h>
 #include <vm/vm_fault.h>
+#include <vm/vm_compress.h>
 #include <vm/vm_map.h>
 #include <vm/vm_object.h>
 #include <vm/vm_page.h>
@@ -200,6 +204,21 @@ int		vm_object_cached_pages;
 
 decl_simple_lock_data(,vm_object_cached_pages_lock_data)
 
+/*
+ *	Objects found at the top of a deep shadow chain are queued
+ *	for the collapser thread, see vm_object_shadow_depth.  The
+ *	queue holds no reference; objects are removed from it before
+ *	being freed.  The lock protects the queue, the collapse_queued
+ *	and collapse_list fields of objects and the counters below.
+ *	It may be taken with an object locked, but not the reverse.
+ */
+queue_head_t	vm_object_collapse_queue;
+unsigned int	vm_object_collapse_count;
+
+decl_simple_lock_data(,vm_object_collapse_lock)
+
+static void vm_object_collapse_dequeue(vm_object_t); /* forward */
+
 /*
  *	Virtual memory objects are initialized from
  *	a template (see vm_object_allocate).
@@ -222,6 +241,8 @@ static void _vm_object_setup(
 {
 	*object = vm_object_template;
 	queue_init(&object->memq);
+	rbtree_init(&object->page_tree);
+	rbtree_init(&object->compressed_tree);
 	vm_object_lock_init(object);
 	object->size = size;
 }
@@ -271,6 +292,9 @@ void vm_object_bootstrap(void)
 	queue_init(&vm_object_cached_list);
 	simple_lock_init(&vm_object_cached_lock_data);
 
+	queue_init(&vm_object_collapse_queue);
+	simple_lock_init(&vm_object_collapse_lock);
+
 	/*
 	 *	Fill in a template object, for quick initialization
 	 */
@@ -310,6 +334,10 @@ void vm_object_bootstrap(void)
 	vm_object_template.lock_in_progress = FALSE;
 	vm_object_template.lock_restart = FALSE;
 	vm_object_template.last_alloc = (vm_offset_t) 0;
+	vm_object_template.cluster_size = PAGE_SIZE;
+	vm_object_template.pagein_next = (vm_offset_t) 0;
+	vm_object_template.pagein_run = 0;
+	vm_object_template.collapse_queued = FALSE;
 
 #if	MACH_PAGEMAP
 	vm_object_template.existence_info = VM_EXTERNAL_NULL;
@@ -577,6 +605,8 @@ void vm_object_terminate(
 
 			VM_PAGE_FREE(p);
 		}
+
+		vm_compress_page_remove(object, 0, (vm_offset_t) -1);
 	} else while (!queue_empty(&object->memq)) {
 		p = (vm_page_t) queue_first(&object->memq);
 
@@ -653,6 +683,7 @@ void vm_object_terminate(
 	 *	Free the space for the object.
 	 */
 
+	vm_object_collapse_dequeue(object);
 	kmem_cache_free(&vm_object_cache, (vm_offset_t) object);
 }
 
@@ -907,10 +938,11 @@ void vm_object_pmap_protect(
 
 		end = offset + size;
 
-		queue_iterate(&object->memq, p, vm_page_t, listq) {
-		    if (!p->fictitious &&
-			(offset <= p->offset) &&
-			(p->offset < end)) {
+		PMAP_BATCH_BEGIN();
+		for (p = vm_page_lookup_range(object, offset, end);
+		     p != VM_PAGE_NULL;
+		     p = vm_page_next_range(p, end)) {
+		    if (!p->fictitious) {
 			if ((pmap == PMAP_NULL) ||
 			    vm_object_pmap_protect_by_page) {
 			    pmap_page_protect(p->phys_addr,
@@ -927,6 +959,7 @@ void vm_object_pmap_protect(
 			}
 		    }
 		}
+		PMAP_BATCH_END();
 	    }
 
 	    if (prot == VM_PROT_NONE) {
@@ -981,10 +1014,10 @@ void vm_object_pmap_remove(
 		return;
 
 	vm_object_lock(object);
-	queue_iterate(&object->memq, p, vm_page_t, listq) {
-		if (!p->fictitious &&
-		    (start <= p->offset) &&
-		    (p->offset < end))
+	for (p = vm_page_lookup_range(object, start, end);
+	     p != VM_PAGE_NULL;
+	     p = vm_page_next_range(p, end)) {
+		if (!p->fictitious)
 			pmap_page_protect(p->phys_addr, VM_PROT_NONE);
 	}
 	vm_object_unlock(object);
@@ -2433,6 +2466,14 @@ void vm_object_collapse(
 				}
 			}
 
+			/*
+			 *	Same for compressed pages, which go
+			 *	along with the pager.
+			 */
+
+			vm_compress_collapse(object, backing_object,
+					     backing_offset);
+
 			/*
 			 *	Move the pager from backing_object to object.
 			 *
@@ -2532,6 +2573,7 @@ void vm_object_collapse(
 			vm_object_unlock(object);
 			if (old_name_port != IP_NULL)
 				ipc_port_dealloc_kernel(old_name_port);
+			vm_object_collapse_dequeue(backing_object);
 			kmem_cache_free(&vm_object_cache, (vm_offset_t) backing_object);
 			vm_object_lock(object);
 
@@ -2629,6 +2671,300 @@ void vm_object_collapse(
 	}
 }
 
+/*
+ *	Background collapse of deep shadow chains.
+ *
+ *	vm_object_collapse gives up as soon as an object is busy,
+ *	and it is only tried when a reference goes away, so tasks
+ *	that fork repeatedly can build shadow chains that every
+ *	fault then walks.  Faults report how deep they had to look;
+ *	top objects beyond vm_object_collapse_depth are queued, and
+ *	the collapser thread later collapses or bypasses their chain
+ *	when it is idle, retrying those that are still busy.
+ */
+unsigned int	vm_object_collapse_depth = 4;
+
+/*
+ *	Statistics, see host_vm_shadow_info.  The histogram is
+ *	updated without locking, like vm_stat.
+ */
+unsigned int	vm_object_shadow_depths[VM_SHADOW_INFO_DEPTHS];
+unsigned int	vm_object_shadow_depth_max;
+unsigned int	vm_object_collapse_queued;
+unsigned int	vm_object_collapse_deferred;
+unsigned int	vm_object_collapse_background;
+
+/*
+ *	Longest part of a chain walked at once by the collapser,
+ *	and how long it waits when everything queued was busy.
+ */
+#define	VM_OBJECT_COLLAPSE_LEVELS	64
+#define	VM_OBJECT_COLLAPSE_RETRY	(hz / 10)
+
+/*
+ *	Routine:	vm_object_collapse_enqueue [internal]
+ *	Purpose:
+ *		Queue an object for the collapser thread,
+ *		unless it is already queued.
+ *	Conditions:
+ *		The collapse queue is locked.
+ */
+static void
+vm_object_collapse_enqueue(
+	vm_object_t	object)
+{
+	if (object->collapse_queued)
+		return;
+
+	object->collapse_queued = TRUE;
+	queue_enter(&vm_object_collapse_queue, object,
+		    vm_object_t, collapse_list);
+	vm_object_collapse_count++;
+	vm_object_collapse_queued++;
+	thread_wakeup((event_t) &vm_object_collapse_queue);
+}
+
+/*
+ *	Routine:	vm_object_collapse_dequeue [internal]
+ *	Purpose:
+ *		Remove an object about to be freed from
+ *		the collapse queue.
+ *	Conditions:
+ *		Nothing locked.
+ */
+static void
+vm_object_collapse_dequeue(
+	vm_object_t	object)
+{
+	simple_lock(&vm_object_collapse_lock);
+	if (object->collapse_queued) {
+		queue_remove(&vm_object_collapse_queue, object,
+			     vm_object_t, collapse_list);
+		object->collapse_queued = FALSE;
+		vm_object_collapse_count--;
+	}
+	simple_unlock(&vm_object_collapse_lock);
+}
+
+/*
+ *	Routine:	vm_object_shadow_depth
+ *	Purpose:
+ *		Record that a fault on the given object found
+ *		its page depth levels down the shadow chain,
+ *		and queue the object for the collapser thread
+ *		if that is too deep.
+ *	Conditions:
+ *		The object is referenced, and may be locked.
+ */
+void
+vm_object_shadow_depth(
+	vm_object_t	object,
+	unsigned int	depth)
+{
+	vm_object_shadow_depths[(depth < VM_SHADOW_INFO_DEPTHS)
+				? depth : VM_SHADOW_INFO_DEPTHS - 1]++;
+	if (depth > vm_object_shadow_depth_max)
+		vm_object_shadow_depth_max = depth;
+
+	/*
+	 *	Peek at collapse_queued first, so that faults
+	 *	on an already queued object don't take the lock.
+	 */
+
+	if (depth <= vm_object_collapse_depth || object->collapse_queued)
+		return;
+
+	simple_lock(&vm_object_collapse_lock);
+	vm_object_collapse_enqueue(object);
+	simple_unlock(&vm_object_collapse_lock);
+}
+
+/*
+ *	Routine:	vm_object_collapse_chain [internal]
+ *	Purpose:
+ *		Collapse every object of a shadow chain that is
+ *		idle into its backing object, or make it bypass
+ *		its backing object.  Returns whether some object
+ *		of the chain was busy.
+ *	Conditions:
+ *		The top object is locked and referenced.  The
+ *		lock is consumed, the reference is not.
+ */
+static boolean_t
+vm_object_collapse_chain(
+	vm_object_t	top)
+{
+	vm_object_t	object, next;
+	boolean_t	busy;
+	unsigned int	level;
+
+	object = top;
+	busy = FALSE;
+
+	for (level = 0; ; level++) {
+		/*
+		 *	vm_object_collapse only acts on an object with
+		 *	an internal backing object; any other object,
+		 *	like the file at the bottom of a chain, may be
+		 *	paging without holding up the chain.
+		 */
+
+		next = object->shadow;
+		if (next != VM_OBJECT_NULL && next->internal) {
+			if (object->paging_in_progress != 0 ||
+			    object->absent_count != 0)
+				busy = TRUE;
+			else
+				vm_object_collapse(object);
+		}
+
+		/*
+		 *	Hold a reference for the next object, since
+		 *	ours may be the last one on this object.  A
+		 *	busy backing object makes vm_object_collapse
+		 *	give up, so remember to try again later.
+		 */
+
+		next = object->shadow;
+		if (next != VM_OBJECT_NULL) {
+			vm_object_lock(next);
+			if (next->internal && next->paging_in_progress != 0)
+				busy = TRUE;
+			if (level < VM_OBJECT_COLLAPSE_LEVELS)
+				next->ref_count++;
+			vm_object_unlock(next);
+		}
+
+		vm_object_unlock(object);
+		if (object != top)
+			vm_object_deallocate(object);
+
+		if (next == VM_OBJECT_NULL || level >= VM_OBJECT_COLLAPSE_LEVELS)
+			break;
+
+		object = next;
+		vm_object_lock(object);
+	}
+
+	return busy;
+}
+
+/*
+ *	Routine:	vm_object_collapse_thread
+ *	Purpose:
+ *		Body of the collapser thread, which shortens
+ *		the shadow chains of queued objects.
+ */
+void
+vm_object_collapse_thread(void)
+{
+	vm_object_t	object;
+	unsigned int	deferred;
+	boolean_t	busy;
+
+	thread_set_own_priority(BASEPRI_USER);
+
+	simple_lock(&vm_object_collapse_lock);
+	deferred = 0;
+
+	for (;;) {
+		/*
+		 *	Sleep while there is nothing to do, or
+		 *	for a while when every queued object
+		 *	was busy.
+		 */
+
+		if (queue_empty(&vm_object_collapse_queue) ||
+		    deferred >= vm_object_collapse_count) {
+			assert_wait((event_t) &vm_object_collapse_queue,
+				    FALSE);
+			if (!queue_empty(&vm_object_collapse_queue))
+				thread_set_timeout(VM_OBJECT_COLLAPSE_RETRY);
+			simple_unlock(&vm_object_collapse_lock);
+			thread_block(NULL);
+			simple_lock(&vm_object_collapse_lock);
+			deferred = 0;
+			continue;
+		}
+
+		object = (vm_object_t) queue_first(&vm_object_collapse_queue);
+
+		/*
+		 *	The lock order is the reverse of the one
+		 *	used by faults, so only try for the object.
+		 */
+
+		if (!vm_object_lock_try(object)) {
+			queue_remove(&vm_object_collapse_queue, object,
+				     vm_object_t, collapse_list);
+			queue_enter(&vm_object_collapse_queue, object,
+				    vm_object_t, collapse_list);
+			vm_object_collapse_deferred++;
+			deferred++;
+			continue;
+		}
+
+		queue_remove(&vm_object_collapse_queue, object,
+			     vm_object_t, collapse_list);
+		object->collapse_queued = FALSE;
+		vm_object_collapse_count--;
+
+		/*
+		 *	Objects being terminated or sitting in the
+		 *	object cache are left alone.
+		 */
+
+		if (object->ref_count == 0 || !object->alive) {
+			vm_object_unlock(object);
+			continue;
+		}
+
+		object->ref_count++;
+		vm_object_collapse_background++;
+		simple_unlock(&vm_object_collapse_lock);
+
+		busy = vm_object_collapse_chain(object);
+
+		simple_lock(&vm_object_collapse_lock);
+		if (busy) {
+			vm_object_collapse_enqueue(object);
+			vm_object_collapse_deferred++;
+			deferred++;
+		} else
+			deferred = 0;
+		simple_unlock(&vm_object_collapse_lock);
+
+		vm_object_deallocate(object);
+		simple_lock(&vm_object_collapse_lock);
+	}
+}
+
+/*
+ *	Routine:	vm_object_shadow_info
+ *	Purpose:
+ *		Return shadow chain statistics.
+ *	Conditions:
+ *		Nothing locked.
+ */
+void
+vm_object_shadow_info(
+	vm_shadow_info_t	*info)
+{
+	unsigned int	i;
+
+	simple_lock(&vm_object_collapse_lock);
+	info->vsi_queued = vm_object_collapse_queued;
+	info->vsi_deferred = vm_object_collapse_deferred;
+	info->vsi_background = vm_object_collapse_background;
+	simple_unlock(&vm_object_collapse_lock);
+
+	info->vsi_collapses = object_collapses;
+	info->vsi_bypasses = object_bypasses;
+	info->vsi_depth_max = vm_object_shadow_depth_max;
+	for (i = 0; i < VM_SHADOW_INFO_DEPTHS; i++)
+		info->vsi_depth[i] = vm_object_shadow_depths[i];
+}
+
 /*
  *	Routine:	vm_object_page_remove: [internal]
  *	Purpose:
@@ -2638,8 +2974,6 @@ void vm_object_collapse(
  *	In/out conditions:
  *		The object must be locked.
  */
-unsigned int vm_object_page_remove_lookup = 0;
-unsigned int vm_object_page_remove_iterate = 0;
 
 void vm_object_page_remove(
 	vm_object_t	object,
@@ -2649,38 +2983,21 @@ void vm_object_page_remove(
 	vm_page_t	p, next;
 
 	/*
-	 *	One and two page removals are most popular.
-	 *	The factor of 16 here is somewhat arbitrary.
-	 *	It balances vm_object_lookup vs iteration.
+	 *	The page tree of the object visits only the resident
+	 *	pages of the range, whatever its size.  The next page
+	 *	must be found before the current one leaves the tree.
 	 */
 
-	if (atop(end - start) < object->resident_page_count/16) {
-		vm_object_page_remove_lookup++;
-
-		for (; start < end; start += PAGE_SIZE) {
-			p = vm_page_lookup(object, start);
-			if (p != VM_PAGE_NULL) {
-				if (!p->fictitious)
-					pmap_page_protect(p->phys_addr,
-							  VM_PROT_NONE);
-				VM_PAGE_FREE(p);
-			}
-		}
-	} else {
-		vm_object_page_remove_iterate++;
-
-		p = (vm_page_t) queue_first(&object->memq);
-		while (!queue_end(&object->memq, (queue_entry_t) p)) {
-			next = (vm_page_t) queue_next(&p->listq);
-			if ((start <= p->offset) && (p->offset < end)) {
-				if (!p->fictitious)
-				    pmap_page_protect(p->phys_addr,
-						      VM_PROT_NONE);
-				VM_PAGE_FREE(p);
-			}
-			p = next;
-		}
+	p = vm_page_lookup_range(object, start, end);
+	while (p != VM_PAGE_NULL) {
+		next = vm_page_next_range(p, end);
+		if (!p->fictitious)
+			pmap_page_protect(p->phys_addr, VM_PROT_NONE);
+		VM_PAGE_FREE(p);
+		p = next;
 	}
+
+	vm_compress_page_remove(object, start, end);
 }
 
 /*
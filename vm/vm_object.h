@@ -46,8 +46,10 @@
 #include <kern/assert.h>
 #include <kern/debug.h>
 #include <kern/macros.h>
+#include <kern/rbtree.h>
 #include <vm/pmap.h>
 #include <ipc/ipc_types.h>
+#include <mach_debug/vm_info.h>
 
 #if	MACH_PAGEMAP
 #include <vm/vm_external.h>
@@ -63,6 +65,13 @@ typedef struct ipc_port *	pager_request_t;
 
 struct vm_object {
 	queue_head_t		memq;		/* Resident memory */
+	struct rbtree		page_tree;	/* Resident memory,
+						 * by offset
+						 */
+	struct rbtree		compressed_tree; /* Compressed memory,
+						 * by offset, see
+						 * vm_compress.c
+						 */
 	decl_simple_lock_data(,	Lock)		/* Synchronization */
 #if	VM_OBJECT_DEBUG
 	thread_t		LockHolder;	/* Thread holding Lock */
@@ -160,6 +169,24 @@ struct vm_object {
 						 * of their can_persist value
 						 */
 	vm_offset_t		last_alloc;	/* last allocation offset */
+	vm_size_t		cluster_size;	/* Largest data request the
+						 * memory manager accepts
+						 */
+	vm_offset_t		pagein_next;	/* Offset following the last
+						 * data request
+						 */
+	unsigned int		pagein_run;	/* Number of sequential data
+						 * requests in a row
+						 */
+	boolean_t		collapse_queued; /* On the collapse queue;
+						 * this and collapse_list are
+						 * protected by the collapse
+						 * queue lock, see
+						 * vm_object_shadow_depth
+						 */
+	queue_chain_t		collapse_list;	/* Attachment point for the
+						 * collapse queue
+						 */
 #if	MACH_PAGEMAP
 	vm_external_t		existence_info;
 #endif	/* MACH_PAGEMAP */
@@ -199,6 +226,9 @@ extern void		vm_object_shadow(
 	vm_offset_t	*offset,	/* in/out */
 	vm_size_t	length);
 extern void		vm_object_collapse(vm_object_t);
+extern void		vm_object_shadow_depth(vm_object_t, unsigned int);
+extern void		vm_object_collapse_thread(void);
+extern void		vm_object_shadow_info(vm_shadow_info_t *);
 extern vm_object_t	vm_object_lookup(struct ipc_port *);
 extern vm_object_t	vm_object_lookup_name(struct ipc_port *);
 extern struct ipc_port	*vm_object_name(vm_object_t);
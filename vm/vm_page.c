@@ -28,6 +28,11 @@
  * it is filled by transferring multiple pages from the backend buddy system.
  * The symmetric case is handled likewise.
  *
+ * On NUMA machines, the free blocks of a segment are further split by
+ * memory node, and allocations are served from the node of the calling
+ * processor first, falling back to other nodes by increasing distance.
+ * Buddies are only merged within a node.
+ *
  * TODO Limit number of dirty pages, block allocations above a top limit.
  */
 
@@ -45,6 +50,7 @@
 #include <machine/pmap.h>
 #include <sys/types.h>
 #include <vm/memory_object.h>
+#include <vm/vm_compress.h>
 #include <vm/vm_page.h>
 #include <vm/vm_pageout.h>
 
@@ -104,6 +110,14 @@ struct vm_page_free_list {
     struct list blocks;
 };
 
+/*
+ * Free blocks of a segment which belong to one memory node.
+ */
+struct vm_page_seg_node {
+    struct vm_page_free_list free_lists[VM_PAGE_NR_FREE_LISTS];
+    unsigned long nr_free_pages;
+};
+
 /*
  * XXX Because of a potential deadlock involving the default pager (see
  * vm_map_lock()), it's currently impossible to reliably determine the
@@ -164,11 +178,21 @@ struct vm_page_free_list {
 #endif /* VM_PAGE_SEG_MIN_PAGES <= VM_PAGE_SEG_THRESHOLD_HIGH */
 
 /*
- * Ratio used to compute the threshold of active pages beyond which
- * to refill the inactive queue.
+ * Share of the page cache, in 1/VM_PAGE_ACTIVE_SHARE_DENOM units,
+ * beyond which to refill the inactive queue.
+ *
+ * The share starts at a third, and moves between its bounds as
+ * evicted pages are faulted in again, or not, see vm_page_refault.
  */
-#define VM_PAGE_HIGH_ACTIVE_PAGE_NUM    1
-#define VM_PAGE_HIGH_ACTIVE_PAGE_DENOM  3
+#define VM_PAGE_ACTIVE_SHARE_DENOM      1024
+#define VM_PAGE_ACTIVE_SHARE_DEFAULT    (VM_PAGE_ACTIVE_SHARE_DENOM / 3)
+#define VM_PAGE_ACTIVE_SHARE_MIN        (VM_PAGE_ACTIVE_SHARE_DENOM / 8)
+#define VM_PAGE_ACTIVE_SHARE_MAX        (VM_PAGE_ACTIVE_SHARE_DENOM * 3 / 4)
+
+/*
+ * Number of physical pages per shadow entry.
+ */
+#define VM_PAGE_SHADOW_RATIO 4
 
 /*
  * Page cache queue.
@@ -204,7 +228,7 @@ struct vm_page_seg {
     struct vm_page *pages;
     struct vm_page *pages_end;
     simple_lock_data_t lock;
-    struct vm_page_free_list free_lists[VM_PAGE_NR_FREE_LISTS];
+    struct vm_page_seg_node nodes[VM_PAGE_MAX_NODES];
     unsigned long nr_free_pages;
 
     /* Free memory thresholds */
@@ -219,6 +243,29 @@ struct vm_page_seg {
     unsigned long high_active_pages;
     struct vm_page_queue inactive_pages;
     unsigned long nr_inactive_pages;
+
+    /* Free pages already filled with zeros, see vm_page_zero_idle */
+    struct list zeroed_pages;
+    unsigned long nr_zeroed_pages;
+
+    /* Number of pages evicted, or reactivated on eviction */
+    unsigned long eviction_clock;
+};
+
+/*
+ * Shadow entry.
+ *
+ * A shadow entry remembers the position of the eviction clock of its
+ * segment when a page was evicted, for as long as the entry isn't
+ * reused for another page. If the page is faulted in again, the
+ * distance between both clock positions is the number of pages the
+ * inactive queue lacked to keep it resident.
+ */
+struct vm_page_shadow {
+    vm_object_t object;
+    vm_offset_t offset;
+    unsigned long eviction;
+    unsigned int seg_index;
 };
 
 /*
@@ -262,6 +309,50 @@ static struct vm_page_boot_seg vm_page_boot_segs[VM_PAGE_MAX_SEGS] __initdata;
  */
 static unsigned int vm_page_segs_size __read_mostly;
 
+/*
+ * Maximum number of physical memory ranges assigned to nodes.
+ */
+#define VM_PAGE_MAX_NODE_RANGES 32
+
+/*
+ * Bootstrap information about the node of a physical memory range.
+ */
+struct vm_page_boot_node {
+    phys_addr_t start;
+    phys_addr_t end;
+    unsigned int node;
+};
+
+/*
+ * Bootstrap node range table.
+ */
+static struct vm_page_boot_node vm_page_boot_nodes[VM_PAGE_MAX_NODE_RANGES]
+    __initdata;
+static unsigned int vm_page_boot_nodes_size __initdata;
+
+/*
+ * Node distances, as reported by the firmware, 0 if unknown.
+ */
+static unsigned int vm_page_node_distances[VM_PAGE_MAX_NODES]
+                                          [VM_PAGE_MAX_NODES] __initdata;
+
+/*
+ * Number of memory nodes.
+ */
+static unsigned int vm_page_nodes_size __read_mostly = 1;
+
+/*
+ * Allocation order of nodes, for each node : the node itself first,
+ * then other nodes by increasing distance.
+ */
+static unsigned short vm_page_node_fallbacks[VM_PAGE_MAX_NODES]
+                                            [VM_PAGE_MAX_NODES] __read_mostly;
+
+/*
+ * Node of each processor.
+ */
+static unsigned short vm_page_cpu_nodes[NCPUS] __read_mostly;
+
 /*
  * If true, unprivileged allocations are blocked, disregarding any other
  * condition.
@@ -272,6 +363,60 @@ static unsigned int vm_page_segs_size __read_mostly;
  */
 static boolean_t vm_page_alloc_paused;
 
+/*
+ * Default number of free pages per segment that idle processors fill
+ * with zeros ahead of zero-fill page faults.
+ */
+#define VM_PAGE_ZEROED_MAX 256
+
+/*
+ * Maximum size of the pre-zeroed page pool of each segment, and the
+ * number of zero-fill allocations served or not from the pools.
+ */
+unsigned long vm_page_zeroed_max = VM_PAGE_ZEROED_MAX;
+unsigned long vm_page_zeroed_hits;
+unsigned long vm_page_zeroed_misses;
+
+/*
+ * Table of shadow entries, indexed by a hash of the object and offset
+ * of evicted pages. Entries are replaced on collision.
+ *
+ * The active share is global, since entries of all segments move it.
+ * Both are protected by the shadow lock.
+ */
+static struct vm_page_shadow *vm_page_shadows;
+static unsigned long vm_page_shadows_size;
+decl_simple_lock_data(static, vm_page_shadow_lock)
+
+/*
+ * Refault counters, protected by the shadow lock.
+ */
+unsigned int vm_page_refaults;
+unsigned int vm_page_workingset_refaults;
+static unsigned int vm_page_active_share = VM_PAGE_ACTIVE_SHARE_DEFAULT;
+
+static unsigned int __init
+vm_page_boot_node_lookup(phys_addr_t pa)
+{
+    const struct vm_page_boot_node *boot_node;
+    unsigned int i;
+
+    for (i = 0; i < vm_page_boot_nodes_size; i++) {
+        boot_node = &vm_page_boot_nodes[i];
+
+        if ((pa >= boot_node->start) && (pa < boot_node->end))
+            return boot_node->node;
+    }
+
+    return 0;
+}
+
+static inline unsigned int
+vm_page_cpu_node(void)
+{
+    return vm_page_cpu_nodes[cpu_number()];
+}
+
 static void __init
 vm_page_init_pa(struct vm_page *page, unsigned short seg_index, phys_addr_t pa)
 {
@@ -279,6 +424,7 @@ vm_page_init_pa(struct vm_page *page, unsigned short seg_index, phys_addr_t pa)
     vm_page_init(page); /* vm_resident members */
     page->type = VM_PT_RESERVED;
     page->seg_index = seg_index;
+    page->node_index = vm_page_boot_node_lookup(pa);
     page->order = VM_PAGE_ORDER_UNLISTED;
     page->priv = NULL;
     page->phys_addr = pa;
@@ -356,12 +502,42 @@ vm_page_free_list_remove(struct vm_page_free_list *free_list,
     list_remove(&page->node);
 }
 
+static void __init
+vm_page_seg_node_init(struct vm_page_seg_node *seg_node)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(seg_node->free_lists); i++)
+        vm_page_free_list_init(&seg_node->free_lists[i]);
+
+    seg_node->nr_free_pages = 0;
+}
+
+/*
+ * Return the index of the first non empty free list of a node able to
+ * satisfy an allocation of the given order, VM_PAGE_NR_FREE_LISTS if none.
+ */
+static unsigned int
+vm_page_seg_node_find_list(const struct vm_page_seg_node *seg_node,
+                           unsigned int order)
+{
+    unsigned int i;
+
+    for (i = order; i < VM_PAGE_NR_FREE_LISTS; i++)
+        if (seg_node->free_lists[i].size != 0)
+            break;
+
+    return i;
+}
+
 static struct vm_page *
-vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
+vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order,
+                             unsigned int node)
 {
-    struct vm_page_free_list *free_list = free_list;
+    struct vm_page_seg_node *seg_node = seg_node;
+    struct vm_page_free_list *free_list;
     struct vm_page *page, *buddy;
-    unsigned int i;
+    unsigned int i, j;
 
     assert(order < VM_PAGE_NR_FREE_LISTS);
 
@@ -378,16 +554,20 @@ vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
         }
     }
 
-    for (i = order; i < VM_PAGE_NR_FREE_LISTS; i++) {
-        free_list = &seg->free_lists[i];
+    i = VM_PAGE_NR_FREE_LISTS;
 
-        if (free_list->size != 0)
+    for (j = 0; j < vm_page_nodes_size; j++) {
+        seg_node = &seg->nodes[vm_page_node_fallbacks[node][j]];
+        i = vm_page_seg_node_find_list(seg_node, order);
+
+        if (i < VM_PAGE_NR_FREE_LISTS)
             break;
     }
 
     if (i == VM_PAGE_NR_FREE_LISTS)
         return NULL;
 
+    free_list = &seg_node->free_lists[i];
     page = list_first_entry(&free_list->blocks, struct vm_page, node);
     vm_page_free_list_remove(free_list, page);
     page->order = VM_PAGE_ORDER_UNLISTED;
@@ -395,10 +575,11 @@ vm_page_seg_alloc_from_buddy(struct vm_page_seg *seg, unsigned int order)
     while (i > order) {
         i--;
         buddy = &page[1 << i];
-        vm_page_free_list_insert(&seg->free_lists[i], buddy);
+        vm_page_free_list_insert(&seg_node->free_lists[i], buddy);
         buddy->order = i;
     }
 
+    seg_node->nr_free_pages -= (1 << order);
     seg->nr_free_pages -= (1 << order);
 
     if (seg->nr_free_pages < seg->min_free_pages) {
@@ -412,6 +593,7 @@ static void
 vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
                           unsigned int order)
 {
+    struct vm_page_seg_node *seg_node;
     struct vm_page *buddy;
     phys_addr_t pa, buddy_pa;
     unsigned int nr_pages;
@@ -420,7 +602,9 @@ vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
     assert(page < seg->pages_end);
     assert(page->order == VM_PAGE_ORDER_UNLISTED);
     assert(order < VM_PAGE_NR_FREE_LISTS);
+    assert(page->node_index < vm_page_nodes_size);
 
+    seg_node = &seg->nodes[page->node_index];
     nr_pages = (1 << order);
     pa = page->phys_addr;
 
@@ -432,18 +616,20 @@ vm_page_seg_free_to_buddy(struct vm_page_seg *seg, struct vm_page *page,
 
         buddy = &seg->pages[vm_page_atop(buddy_pa - seg->start)];
 
-        if (buddy->order != order)
+        if ((buddy->order != order)
+            || (buddy->node_index != page->node_index))
             break;
 
-        vm_page_free_list_remove(&seg->free_lists[order], buddy);
+        vm_page_free_list_remove(&seg_node->free_lists[order], buddy);
         buddy->order = VM_PAGE_ORDER_UNLISTED;
         order++;
         pa &= -vm_page_ptoa(1 << order);
         page = &seg->pages[vm_page_atop(pa - seg->start)];
     }
 
-    vm_page_free_list_insert(&seg->free_lists[order], page);
+    vm_page_free_list_insert(&seg_node->free_lists[order], page);
     page->order = order;
+    seg_node->nr_free_pages += nr_pages;
     seg->nr_free_pages += nr_pages;
 }
 
@@ -486,7 +672,7 @@ vm_page_cpu_pool_push(struct vm_page_cpu_pool *cpu_pool, struct vm_page *page)
 
 static int
 vm_page_cpu_pool_fill(struct vm_page_cpu_pool *cpu_pool,
-                      struct vm_page_seg *seg)
+                      struct vm_page_seg *seg, unsigned int node)
 {
     struct vm_page *page;
     int i;
@@ -496,7 +682,7 @@ vm_page_cpu_pool_fill(struct vm_page_cpu_pool *cpu_pool,
     simple_lock(&seg->lock);
 
     for (i = 0; i < cpu_pool->transfer_size; i++) {
-        page = vm_page_seg_alloc_from_buddy(seg, 0);
+        page = vm_page_seg_alloc_from_buddy(seg, 0, node);
 
         if (page == NULL)
             break;
@@ -660,8 +846,8 @@ vm_page_seg_init(struct vm_page_seg *seg, phys_addr_t start, phys_addr_t end,
     seg->pages_end = pages + vm_page_atop(vm_page_seg_size(seg));
     simple_lock_init(&seg->lock);
 
-    for (i = 0; i < ARRAY_SIZE(seg->free_lists); i++)
-        vm_page_free_list_init(&seg->free_lists[i]);
+    for (i = 0; i < ARRAY_SIZE(seg->nodes); i++)
+        vm_page_seg_node_init(&seg->nodes[i]);
 
     seg->nr_free_pages = 0;
 
@@ -671,6 +857,9 @@ vm_page_seg_init(struct vm_page_seg *seg, phys_addr_t start, phys_addr_t end,
     seg->nr_active_pages = 0;
     vm_page_queue_init(&seg->inactive_pages);
     seg->nr_inactive_pages = 0;
+    list_init(&seg->zeroed_pages);
+    seg->nr_zeroed_pages = 0;
+    seg->eviction_clock = 0;
 
     i = vm_page_seg_index(seg);
 
@@ -684,6 +873,7 @@ vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
 {
     struct vm_page_cpu_pool *cpu_pool;
     struct vm_page *page;
+    unsigned int node;
     int filled;
 
     assert(order < VM_PAGE_NR_FREE_LISTS);
@@ -691,10 +881,11 @@ vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
     if (order == 0) {
         thread_pin();
         cpu_pool = vm_page_cpu_pool_get(seg);
+        node = vm_page_cpu_node();
         simple_lock(&cpu_pool->lock);
 
         if (cpu_pool->nr_pages == 0) {
-            filled = vm_page_cpu_pool_fill(cpu_pool, seg);
+            filled = vm_page_cpu_pool_fill(cpu_pool, seg, node);
 
             if (!filled) {
                 simple_unlock(&cpu_pool->lock);
@@ -708,7 +899,7 @@ vm_page_seg_alloc(struct vm_page_seg *seg, unsigned int order,
         thread_unpin();
     } else {
         simple_lock(&seg->lock);
-        page = vm_page_seg_alloc_from_buddy(seg, order);
+        page = vm_page_seg_alloc_from_buddy(seg, order, vm_page_cpu_node());
         simple_unlock(&seg->lock);
 
         if (page == NULL)
@@ -731,7 +922,11 @@ vm_page_seg_free(struct vm_page_seg *seg, struct vm_page *page,
 
     vm_page_set_type(page, order, VM_PT_FREE);
 
-    if (order == 0) {
+    /*
+     * Pages of remote nodes bypass the CPU pool, so that they don't get
+     * handed out again on this processor.
+     */
+    if ((order == 0) && (page->node_index == vm_page_cpu_node())) {
         thread_pin();
         cpu_pool = vm_page_cpu_pool_get(seg);
         simple_lock(&cpu_pool->lock);
@@ -998,7 +1193,7 @@ vm_page_seg_balance_page(struct vm_page_seg *seg,
     assert(src->type != VM_PT_FREE);
     assert(src->order == VM_PAGE_ORDER_UNLISTED);
 
-    dest = vm_page_seg_alloc_from_buddy(remote_seg, 0);
+    dest = vm_page_seg_alloc_from_buddy(remote_seg, 0, src->node_index);
     assert(dest != NULL);
 
     vm_page_seg_double_unlock(seg, remote_seg);
@@ -1083,6 +1278,60 @@ vm_page_seg_balance(struct vm_page_seg *seg)
     return FALSE;
 }
 
+static inline struct vm_page_shadow *
+vm_page_shadow_get(vm_object_t object, vm_offset_t offset)
+{
+    unsigned long hash;
+
+    hash = ((unsigned long)object >> 4) + vm_page_atop(offset);
+    hash *= 0x9e3779b1UL;
+    hash ^= hash >> 16;
+    return &vm_page_shadows[hash & (vm_page_shadows_size - 1)];
+}
+
+/*
+ * Advance the eviction clock of a segment and leave a shadow entry for
+ * a page about to be evicted from it.
+ *
+ * An entry replaced after a full cycle of its segment's page cache
+ * queues without its page being faulted in again means the page wasn't
+ * reused soon enough to deserve more room on the inactive queue, which
+ * lets the active share grow back. Younger entries are replaced without
+ * this conclusion, since collisions alone would otherwise push the share
+ * to its maximum once the table is full.
+ *
+ * The segment must be locked.
+ */
+static void
+vm_page_seg_record_shadow(struct vm_page_seg *seg, struct vm_page *page)
+{
+    struct vm_page_shadow *shadow;
+    struct vm_page_seg *shadow_seg;
+    unsigned long age;
+
+    seg->eviction_clock++;
+
+    simple_lock(&vm_page_shadow_lock);
+    shadow = vm_page_shadow_get(page->object, page->offset);
+
+    if (shadow->object != NULL) {
+        /* Other segments are read without locking, as in vm_page_refault */
+        shadow_seg = vm_page_seg_get(shadow->seg_index);
+        age = shadow_seg->eviction_clock - shadow->eviction;
+
+        if ((age > (shadow_seg->nr_active_pages
+                    + shadow_seg->nr_inactive_pages))
+            && (vm_page_active_share < VM_PAGE_ACTIVE_SHARE_MAX))
+            vm_page_active_share++;
+    }
+
+    shadow->object = page->object;
+    shadow->offset = page->offset;
+    shadow->eviction = seg->eviction_clock;
+    shadow->seg_index = vm_page_seg_index(seg);
+    simple_unlock(&vm_page_shadow_lock);
+}
+
 static boolean_t
 vm_page_seg_evict(struct vm_page_seg *seg, boolean_t external_only,
                   boolean_t alloc_paused)
@@ -1121,6 +1370,7 @@ restart:
     if (!was_active
         && (page->reference || pmap_is_referenced(page->phys_addr))) {
         vm_page_seg_add_active_page(seg, page);
+        seg->eviction_clock++;
         simple_unlock(&seg->lock);
         vm_object_unlock(object);
         vm_stat.reactivations++;
@@ -1132,6 +1382,11 @@ restart:
 
     vm_page_remove_mappings(page);
 
+    /* A page being double paged was already recorded on the first pass */
+    if (!double_paging) {
+        vm_page_seg_record_shadow(seg, page);
+    }
+
     if (!page->dirty && !page->precious) {
         reclaim = TRUE;
         goto out;
@@ -1212,7 +1467,20 @@ out:
         panic("vm_page_seg_evict");
     }
 
-    vm_pageout_page(page, FALSE, TRUE); /* flush it */
+    /*
+     * Write back the dirty inactive pages around the victim along
+     * with it, unless it's about to be double paged, in which case
+     * it must be pushed alone so that it can be found again.
+     */
+
+    if (double_paging) {
+        vm_pageout_page(page, FALSE, TRUE); /* flush it */
+    } else if (object->internal && vm_compress_page(page, alloc_paused)) {
+        /* Kept in memory, compressed */
+    } else {
+        vm_pageout_cluster(page);
+    }
+
     vm_object_unlock(object);
 
     if (double_paging) {
@@ -1222,14 +1490,67 @@ out:
     return TRUE;
 }
 
+void
+vm_page_record_eviction(struct vm_page *page)
+{
+    struct vm_page_seg *seg;
+
+    assert(page->busy);
+
+    seg = vm_page_seg_get(page->seg_index);
+    simple_lock(&seg->lock);
+    vm_page_seg_record_shadow(seg, page);
+    simple_unlock(&seg->lock);
+}
+
+void
+vm_page_refault(vm_object_t object, vm_offset_t offset)
+{
+    struct vm_page_shadow *shadow;
+    struct vm_page_seg *seg;
+    unsigned long distance;
+
+    simple_lock(&vm_page_shadow_lock);
+    shadow = vm_page_shadow_get(object, offset);
+
+    if ((shadow->object != object) || (shadow->offset != offset)) {
+        simple_unlock(&vm_page_shadow_lock);
+        return;
+    }
+
+    shadow->object = NULL;
+    vm_page_refaults++;
+
+    /*
+     * The clock is read without locking the segment. A stale value
+     * only makes the distance slightly off.
+     */
+    seg = vm_page_seg_get(shadow->seg_index);
+    distance = seg->eviction_clock - shadow->eviction;
+
+    /*
+     * If the page would have stayed resident with an inactive queue
+     * larger by no more than the active one, it belongs to the working
+     * set, and the active queue should make room for the inactive one.
+     */
+    if (distance <= seg->nr_active_pages) {
+        vm_page_workingset_refaults++;
+
+        if (vm_page_active_share > VM_PAGE_ACTIVE_SHARE_MIN)
+            vm_page_active_share--;
+    }
+
+    simple_unlock(&vm_page_shadow_lock);
+}
+
 static void
 vm_page_seg_compute_high_active_page(struct vm_page_seg *seg)
 {
     unsigned long nr_pages;
 
     nr_pages = seg->nr_active_pages + seg->nr_inactive_pages;
-    seg->high_active_pages = nr_pages * VM_PAGE_HIGH_ACTIVE_PAGE_NUM
-                             / VM_PAGE_HIGH_ACTIVE_PAGE_DENOM;
+    seg->high_active_pages = nr_pages * vm_page_active_share
+                             / VM_PAGE_ACTIVE_SHARE_DENOM;
 }
 
 static void
@@ -1307,6 +1628,107 @@ vm_page_load_heap(unsigned int seg_index, phys_addr_t start, phys_addr_t end)
 #endif
 }
 
+void __init
+vm_page_load_node(unsigned int node, phys_addr_t start, phys_addr_t end)
+{
+    struct vm_page_boot_node *boot_node;
+
+    assert(node < VM_PAGE_MAX_NODES);
+    assert(start < end);
+    assert(!vm_page_is_ready);
+
+    if (vm_page_boot_nodes_size == ARRAY_SIZE(vm_page_boot_nodes)) {
+        printf("vm_page: too many node ranges, ignoring %llx:%llx\n",
+               (unsigned long long)start, (unsigned long long)end);
+        return;
+    }
+
+    boot_node = &vm_page_boot_nodes[vm_page_boot_nodes_size];
+    boot_node->start = vm_page_trunc(start);
+    boot_node->end = vm_page_round(end);
+    boot_node->node = node;
+    vm_page_boot_nodes_size++;
+
+    if (node >= vm_page_nodes_size)
+        vm_page_nodes_size = node + 1;
+
+#if DEBUG
+    printf("vm_page: node %u: %llx:%llx\n", node,
+           (unsigned long long)start, (unsigned long long)end);
+#endif
+}
+
+void __init
+vm_page_set_node_distance(unsigned int from, unsigned int to,
+                          unsigned int distance)
+{
+    assert(from < VM_PAGE_MAX_NODES);
+    assert(to < VM_PAGE_MAX_NODES);
+    assert(!vm_page_is_ready);
+
+    vm_page_node_distances[from][to] = distance;
+}
+
+void
+vm_page_set_cpu_node(unsigned int cpu, unsigned int node)
+{
+    assert(cpu < ARRAY_SIZE(vm_page_cpu_nodes));
+    assert(node < VM_PAGE_MAX_NODES);
+
+    vm_page_cpu_nodes[cpu] = node;
+}
+
+static unsigned int __init
+vm_page_node_distance(unsigned int from, unsigned int to)
+{
+    unsigned int distance;
+
+    distance = vm_page_node_distances[from][to];
+
+    if (distance != 0)
+        return distance;
+
+    return (from == to) ? VM_PAGE_NODE_LOCAL_DISTANCE
+                        : 2 * VM_PAGE_NODE_LOCAL_DISTANCE;
+}
+
+/*
+ * Compute the allocation order of nodes, by insertion sort on distance.
+ * The node itself always comes first, and nodes at equal distance are
+ * kept in index order.
+ */
+static void __init
+vm_page_compute_node_fallbacks(void)
+{
+    unsigned short *fallbacks, tmp;
+    unsigned int i, j, k;
+
+    for (i = 0; i < vm_page_nodes_size; i++) {
+        fallbacks = vm_page_node_fallbacks[i];
+        fallbacks[0] = i;
+
+        for (j = 1, k = 0; k < vm_page_nodes_size; k++)
+            if (k != i)
+                fallbacks[j++] = k;
+
+        for (j = 2; j < vm_page_nodes_size; j++) {
+            for (k = j; k > 1; k--) {
+                if (vm_page_node_distance(i, fallbacks[k - 1])
+                    <= vm_page_node_distance(i, fallbacks[k]))
+                    break;
+
+                tmp = fallbacks[k - 1];
+                fallbacks[k - 1] = fallbacks[k];
+                fallbacks[k] = tmp;
+            }
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(vm_page_cpu_nodes); i++)
+        if (vm_page_cpu_nodes[i] >= vm_page_nodes_size)
+            vm_page_cpu_nodes[i] = 0;
+}
+
 int
 vm_page_ready(void)
 {
@@ -1409,6 +1831,10 @@ vm_page_setup(void)
     phys_addr_t pa;
 
     vm_page_check_boot_segs();
+    vm_page_compute_node_fallbacks();
+
+    if (vm_page_nodes_size > 1)
+        printf("vm_page: %u memory nodes\n", vm_page_nodes_size);
 
     /*
      * Compute the page table size.
@@ -1424,6 +1850,22 @@ vm_page_setup(void)
     table = (struct vm_page *)pmap_steal_memory(table_size);
     va = (unsigned long)table;
 
+    /*
+     * Allocate the shadow table, with a power-of-two size.
+     */
+    vm_page_shadows_size = 1;
+
+    while ((vm_page_shadows_size * VM_PAGE_SHADOW_RATIO) < nr_pages)
+        vm_page_shadows_size <<= 1;
+
+    table_size = vm_page_round(vm_page_shadows_size
+                               * sizeof(struct vm_page_shadow));
+    printf("vm_page: shadow table size: %lu entries (%luk)\n",
+           vm_page_shadows_size, table_size >> 10);
+    vm_page_shadows = (struct vm_page_shadow *)pmap_steal_memory(table_size);
+    memset(vm_page_shadows, 0, table_size);
+    simple_lock_init(&vm_page_shadow_lock);
+
     /*
      * Initialize the segments, associating them to the page table. When
      * the segments are initialized, all their pages are set allocated.
@@ -1583,6 +2025,123 @@ vm_page_free_pa(struct vm_page *page, unsigned int order)
     vm_page_seg_free(&vm_page_segs[page->seg_index], page, order);
 }
 
+struct vm_page *
+vm_page_alloc_zeroed(unsigned int selector, unsigned short type)
+{
+    struct vm_page_seg *seg;
+    struct vm_page *page;
+    unsigned int i;
+
+    if (vm_page_alloc_paused && current_thread()
+        && !current_thread()->vm_privilege) {
+        vm_page_zeroed_misses++;
+        return NULL;
+    }
+
+    for (i = vm_page_select_alloc_seg(selector); i < vm_page_segs_size; i--) {
+        seg = &vm_page_segs[i];
+
+        if (seg->nr_zeroed_pages == 0)
+            continue;
+
+        simple_lock(&seg->lock);
+
+        if (list_empty(&seg->zeroed_pages)) {
+            simple_unlock(&seg->lock);
+            continue;
+        }
+
+        page = list_first_entry(&seg->zeroed_pages, struct vm_page, node);
+        list_remove(&page->node);
+        seg->nr_zeroed_pages--;
+        simple_unlock(&seg->lock);
+
+        assert(page->type == VM_PT_FREE);
+        vm_page_set_type(page, 0, type);
+        vm_page_zeroed_hits++;
+        return page;
+    }
+
+    vm_page_zeroed_misses++;
+    return NULL;
+}
+
+boolean_t
+vm_page_zero_idle(void)
+{
+    struct vm_page_seg *seg;
+    struct vm_page *page;
+    unsigned int i;
+
+    if (!vm_page_is_ready)
+        return FALSE;
+
+    for (i = vm_page_select_alloc_seg(VM_PAGE_SEL_DIRECTMAP);
+         i < vm_page_segs_size;
+         i--) {
+        seg = &vm_page_segs[i];
+
+        if ((seg->nr_zeroed_pages >= vm_page_zeroed_max)
+            || (seg->nr_free_pages <= seg->high_free_pages))
+            continue;
+
+        simple_lock(&vm_page_queue_free_lock);
+        simple_lock(&seg->lock);
+
+        if (seg->nr_free_pages > seg->high_free_pages)
+            page = vm_page_seg_alloc_from_buddy(seg, 0, vm_page_cpu_node());
+        else
+            page = NULL;
+
+        simple_unlock(&seg->lock);
+        simple_unlock(&vm_page_queue_free_lock);
+
+        if (page == NULL)
+            continue;
+
+        pmap_zero_page_nocache(page->phys_addr);
+
+        simple_lock(&seg->lock);
+        list_insert_head(&seg->zeroed_pages, &page->node);
+        seg->nr_zeroed_pages++;
+        simple_unlock(&seg->lock);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Return the pre-zeroed pages of all segments to the buddy allocators.
+ *
+ * The free page queue lock must be held.
+ */
+static void
+vm_page_zeroed_drain(void)
+{
+    struct vm_page_seg *seg;
+    struct vm_page *page;
+    unsigned int i;
+
+    for (i = 0; i < vm_page_segs_size; i++) {
+        seg = &vm_page_segs[i];
+
+        if (seg->nr_zeroed_pages == 0)
+            continue;
+
+        simple_lock(&seg->lock);
+
+        while (!list_empty(&seg->zeroed_pages)) {
+            page = list_first_entry(&seg->zeroed_pages, struct vm_page, node);
+            list_remove(&page->node);
+            seg->nr_zeroed_pages--;
+            vm_page_seg_free_to_buddy(seg, page, 0);
+        }
+
+        simple_unlock(&seg->lock);
+    }
+}
+
 const char *
 vm_page_seg_name(unsigned int seg_index)
 {
@@ -1604,7 +2163,7 @@ vm_page_info_all(void)
 {
     struct vm_page_seg *seg;
     unsigned long pages;
-    unsigned int i;
+    unsigned int i, j;
 
     for (i = 0; i < vm_page_segs_size; i++) {
         seg = &vm_page_segs[i];
@@ -1615,6 +2174,16 @@ vm_page_info_all(void)
         printf("vm_page: %s: min:%lu low:%lu high:%lu\n",
                vm_page_seg_name(vm_page_seg_index(seg)),
                seg->min_free_pages, seg->low_free_pages, seg->high_free_pages);
+        printf("vm_page: %s: zeroed: %lu\n",
+               vm_page_seg_name(i), seg->nr_zeroed_pages);
+
+        if (vm_page_nodes_size == 1)
+            continue;
+
+        for (j = 0; j < vm_page_nodes_size; j++)
+            printf("vm_page: %s: node %u: free: %lu (%luM)\n",
+                   vm_page_seg_name(i), j, seg->nodes[j].nr_free_pages,
+                   seg->nodes[j].nr_free_pages >> (20 - PAGE_SHIFT));
     }
 }
 
@@ -1990,8 +2559,19 @@ vm_page_evict(boolean_t *should_wait)
     simple_lock(&vm_page_queue_free_lock);
     vm_page_external_laundry_count = 0;
     alloc_paused = vm_page_alloc_paused;
+
+    /*
+     * Memory is short, pre-zeroed pages are better used as free pages.
+     */
+    vm_page_zeroed_drain();
     simple_unlock(&vm_page_queue_free_lock);
 
+    /*
+     * Make room in the compressed cache for the pages about to be
+     * evicted, by writing its oldest data back to the default pager.
+     */
+    vm_compress_balance();
+
 again:
     vm_page_lock_queues();
     pause = (vm_page_laundry_count >= VM_PAGE_MAX_LAUNDRY);
@@ -45,6 +45,7 @@
 #include <kern/log2.h>
 
 #include <kern/macros.h>
+#include <kern/rbtree.h>
 #include <kern/sched_prim.h>	/* definitions of wait/wakeup */
 
 #if	MACH_VM_DEBUG
@@ -82,6 +83,7 @@ struct vm_page {
 	unsigned short type;
 	unsigned short seg_index;
 	unsigned short order;
+	unsigned short node_index;
 	void *priv;
 
 	/*
@@ -91,7 +93,7 @@ struct vm_page {
 	phys_addr_t phys_addr;
 
 	queue_chain_t	listq;		/* all pages in same object (O) */
-	struct vm_page	*next;		/* VP bucket link (O) */
+	struct rbtree_node tree_node;	/* object page tree link (O) */
 
 	/* We use an empty struct as the delimiter.  */
 	struct {} vm_page_header;
@@ -184,10 +186,18 @@ extern void		vm_page_module_init(void);
 extern vm_page_t	vm_page_lookup(
 	vm_object_t	object,
 	vm_offset_t	offset);
+extern vm_page_t	vm_page_lookup_range(
+	vm_object_t	object,
+	vm_offset_t	start,
+	vm_offset_t	end);
+extern vm_page_t	vm_page_next_range(
+	vm_page_t	mem,
+	vm_offset_t	end);
 extern vm_page_t	vm_page_grab_fictitious(void);
 extern boolean_t	vm_page_convert(vm_page_t *);
 extern void		vm_page_more_fictitious(void);
 extern vm_page_t	vm_page_grab(void);
+extern vm_page_t	vm_page_grab_zeroed(boolean_t *);
 extern void		vm_page_release(vm_page_t, boolean_t, boolean_t);
 extern phys_addr_t	vm_page_grab_phys_addr(void);
 extern vm_page_t	vm_page_grab_contig(vm_size_t, unsigned int);
@@ -385,6 +395,41 @@ void vm_page_load(unsigned int seg_index, phys_addr_t start, phys_addr_t end);
 void vm_page_load_heap(unsigned int seg_index, phys_addr_t start,
                        phys_addr_t end);
 
+/*
+ * Maximum number of memory nodes.
+ */
+#define VM_PAGE_MAX_NODES 8
+
+/*
+ * Distance of a node from itself, other distances are relative to it.
+ */
+#define VM_PAGE_NODE_LOCAL_DISTANCE 10
+
+/*
+ * Assign physical memory to a node at boot time.
+ *
+ * Memory not covered by any range belongs to node 0. Ranges must be
+ * loaded before the vm_page module is set up.
+ */
+void vm_page_load_node(unsigned int node, phys_addr_t start, phys_addr_t end);
+
+/*
+ * Set the distance between two nodes at boot time.
+ *
+ * Nodes for which no distance is set are assumed to be twice as far
+ * from each other as from themselves.
+ */
+void vm_page_set_node_distance(unsigned int from, unsigned int to,
+                               unsigned int distance);
+
+/*
+ * Assign a processor to a node.
+ *
+ * Page allocations made on a processor are served from the memory of
+ * its node first. Processors belong to node 0 unless assigned otherwise.
+ */
+void vm_page_set_cpu_node(unsigned int cpu, unsigned int node);
+
 /*
  * Return true if the vm_page module is completely initialized, false
  * otherwise, in which case only vm_page_bootalloc() can be used for
@@ -445,6 +490,25 @@ struct vm_page * vm_page_alloc_pa(unsigned int order, unsigned int selector,
  */
 void vm_page_free_pa(struct vm_page *page, unsigned int order);
 
+/*
+ * Allocate a single physical page already filled with zeros, from the
+ * pools refilled by vm_page_zero_idle. Return NULL if those pools are
+ * empty, in which case the caller should use vm_page_alloc_pa.
+ *
+ * This function should only be used by the vm_resident module.
+ */
+struct vm_page * vm_page_alloc_zeroed(unsigned int selector,
+                                      unsigned short type);
+
+/*
+ * Fill a free page with zeros and add it to the pre-zeroed pool of its
+ * segment, if a pool isn't full and memory is plentiful.
+ *
+ * This function is called by idle processors. Return TRUE if a page
+ * was zeroed.
+ */
+boolean_t vm_page_zero_idle(void);
+
 /*
  * Return the name of the given segment.
  */
@@ -519,6 +583,33 @@ boolean_t vm_page_balance(void);
  */
 boolean_t vm_page_evict(boolean_t *should_wait);
 
+/*
+ * Leave a shadow entry for a page evicted by vm_pageout_cluster along
+ * with the page chosen by vm_page_evict, so that its refault is accounted
+ * for in the same way.
+ *
+ * The page must be busy.
+ */
+void vm_page_record_eviction(struct vm_page *page);
+
+/*
+ * Report that a page of the given object and offset is being faulted in
+ * from its memory manager.
+ *
+ * If the page was recently evicted, count the refault, and if it came
+ * back soon enough to be part of the working set, give more room to the
+ * inactive queue at the expense of the active one.
+ *
+ * The object must be locked.
+ */
+void vm_page_refault(vm_object_t object, vm_offset_t offset);
+
+/*
+ * Number of refaults, and of refaults of working set pages.
+ */
+extern unsigned int vm_page_refaults;
+extern unsigned int vm_page_workingset_refaults;
+
 /*
  * Turn active pages into inactive ones for second-chance LRU
  * approximation.
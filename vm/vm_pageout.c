@@ -74,6 +74,15 @@ static int vm_pageout_requested;
  */
 static int vm_pageout_continue;
 
+/*
+ * Largest number of pages written back by a single data return
+ * when evicting a page, see vm_pageout_cluster.
+ */
+#define VM_PAGEOUT_CLUSTER_MAX 16
+
+unsigned int vm_pageout_cluster_max = VM_PAGEOUT_CLUSTER_MAX;
+unsigned int vm_pageout_cluster_count;	/* pages written along a victim */
+
 /*
  *	Routine:	vm_pageout_setup
  *	Purpose:
@@ -402,6 +411,165 @@ vm_pageout_page(
 	vm_object_paging_end(old_object);
 }
 
+/*
+ *	Routine:	vm_pageout_cluster_grab
+ *	Purpose:
+ *		Take a neighbour of a page being evicted, so that
+ *		it can be written back along with it.  Only dirty
+ *		inactive pages which haven't been referenced since
+ *		they were deactivated are taken.
+ *
+ *		Returns TRUE if the page was removed from the
+ *		page queues, marked busy and unmapped.
+ *	In/out conditions:
+ *		The object and the page queues must be locked.
+ */
+static boolean_t
+vm_pageout_cluster_grab(vm_page_t m)
+{
+	if ((m == VM_PAGE_NULL) || !m->inactive ||
+	    m->busy || m->wanted || m->absent || m->error ||
+	    m->fictitious || m->private || (m->wire_count != 0) ||
+	    m->laundry || m->external_laundry)
+		return FALSE;
+
+	if (!m->dirty && !pmap_is_modified(m->phys_addr))
+		return FALSE;
+
+	if (m->reference || pmap_is_referenced(m->phys_addr))
+		return FALSE;
+
+	VM_PAGE_QUEUES_REMOVE(m);
+	m->busy = TRUE;
+	pmap_page_protect(m->phys_addr, VM_PROT_NONE);
+	m->dirty = TRUE;
+	return TRUE;
+}
+
+/*
+ *	Routine:	vm_pageout_cluster
+ *	Purpose:
+ *		Flush the specified page to its memory object, like
+ *		vm_pageout_page, together with the dirty inactive
+ *		pages around it in the same object.  All of them are
+ *		sent in a single memory_object_data_return message.
+ *
+ *	In/out conditions:
+ *		The page in question must not be on any pageout queues,
+ *		must be busy and unmapped.  The object to which it
+ *		belongs must be locked.
+ */
+void
+vm_pageout_cluster(vm_page_t m)
+{
+	vm_page_t		pages[2 * VM_PAGEOUT_CLUSTER_MAX];
+	vm_page_t		holding_pages[VM_PAGEOUT_CLUSTER_MAX];
+	vm_page_t		p;
+	vm_map_copy_t		copy;
+	vm_object_t		old_object;
+	vm_object_t		new_object;
+	vm_offset_t		paging_offset;
+	vm_size_t		size;
+	unsigned int		first, last, max, i;
+	kern_return_t		rc;
+
+	assert(m->busy);
+
+	/*
+	 *	Clean precious pages and anything vm_pageout_page
+	 *	would discard take the usual path.
+	 */
+	if (m->absent || m->error || !m->dirty) {
+		vm_pageout_page(m, FALSE, TRUE);
+		return;
+	}
+
+	old_object = m->object;
+	max = vm_pageout_cluster_max;
+	if (max > VM_PAGEOUT_CLUSTER_MAX)
+		max = VM_PAGEOUT_CLUSTER_MAX;
+
+	/*
+	 *	Gather the following pages first, then the
+	 *	preceding ones, so that sequential writers are
+	 *	written back ahead.
+	 */
+	first = last = VM_PAGEOUT_CLUSTER_MAX - 1;
+	pages[first] = m;
+
+	vm_page_lock_queues();
+	while ((last - first + 1 < max) &&
+	       (pages[last]->offset + PAGE_SIZE != 0)) {
+		p = vm_page_lookup(old_object, pages[last]->offset + PAGE_SIZE);
+		if (!vm_pageout_cluster_grab(p))
+			break;
+		pages[++last] = p;
+	}
+	while ((last - first + 1 < max) &&
+	       (pages[first]->offset != 0)) {
+		p = vm_page_lookup(old_object, pages[first]->offset - PAGE_SIZE);
+		if (!vm_pageout_cluster_grab(p))
+			break;
+		pages[--first] = p;
+	}
+	vm_page_unlock_queues();
+
+	if (first == last) {
+		vm_pageout_page(m, FALSE, TRUE);
+		return;
+	}
+
+	/*
+	 *	Create a paging reference to let us play with the object.
+	 */
+	size = ptoa(last - first + 1);
+	paging_offset = pages[first]->offset + old_object->paging_offset;
+	vm_object_paging_begin(old_object);
+	vm_object_unlock(old_object);
+
+	/*
+	 *	Move the pages into a new object, in order.  The
+	 *	neighbours leave memory like the page itself, whose
+	 *	shadow entry vm_page_evict has already recorded.
+	 */
+	new_object = vm_object_allocate(size);
+	new_object->used_for_pageout = TRUE;
+
+	for (i = 0; i <= last - first; i++) {
+		if (pages[first + i] != m)
+			vm_page_record_eviction(pages[first + i]);
+
+		holding_pages[i] = vm_pageout_setup(pages[first + i],
+						    paging_offset + ptoa(i),
+						    new_object,
+						    ptoa(i),
+						    TRUE);
+	}
+
+	rc = vm_map_copyin_object(new_object, 0, size, &copy);
+	assert(rc == KERN_SUCCESS);
+
+	rc = memory_object_data_return(
+		 old_object->pager,
+		 old_object->pager_request,
+		 paging_offset, (pointer_t) copy, size,
+		 TRUE, FALSE);
+
+	if (rc != KERN_SUCCESS)
+		vm_map_copy_discard(copy);
+
+	/*
+	 *	Clean up.
+	 */
+	vm_object_lock(old_object);
+	for (i = 0; i <= last - first; i++)
+		if (holding_pages[i] != VM_PAGE_NULL)
+			VM_PAGE_FREE(holding_pages[i]);
+	vm_object_paging_end(old_object);
+
+	vm_pageout_cluster_count += last - first;
+}
+
 /*
  *	vm_pageout_scan does the dirty work for the pageout daemon.
  *
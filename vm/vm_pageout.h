@@ -43,6 +43,7 @@
 extern vm_page_t vm_pageout_setup(vm_page_t, vm_offset_t, vm_object_t,
 				  vm_offset_t, boolean_t);
 extern void vm_pageout_page(vm_page_t, boolean_t, boolean_t);
+extern void vm_pageout_cluster(vm_page_t);
 
 extern void vm_pageout(void) __attribute__((noreturn));
 
@@ -81,20 +81,13 @@ vm_offset_t virtual_space_end;
 
 /*
  *	The vm_page_lookup() routine, which provides for fast
- *	(virtual memory object, offset) to page lookup, employs
- *	the following hash table.  The vm_page_{insert,remove}
- *	routines install and remove associations in the table.
- *	[This table is often called the virtual-to-physical,
- *	or VP, table.]
+ *	(virtual memory object, offset) to page lookup, uses
+ *	a red-black tree of the resident pages of each object,
+ *	keyed by offset.  The vm_page_{insert,remove} routines
+ *	install and remove associations in the tree, which is
+ *	protected by the object lock.  [These trees replace
+ *	the global virtual-to-physical, or VP, table.]
  */
-typedef struct {
-	decl_simple_lock_data(,lock)
-	vm_page_t pages;
-} vm_page_bucket_t;
-
-vm_page_bucket_t *vm_page_buckets;		/* Array of buckets */
-unsigned long	vm_page_bucket_count = 0;	/* How big is array? */
-unsigned long	vm_page_hash_mask;		/* Mask for hash function */
 
 static struct list	vm_page_queue_fictitious;
 decl_simple_lock_data(,vm_page_queue_free_lock)
@@ -169,8 +162,6 @@ void vm_page_bootstrap(
 	vm_offset_t *startp,
 	vm_offset_t *endp)
 {
-	int i;
-
 	/*
 	 *	Initialize the page queues.
 	 */
@@ -180,40 +171,6 @@ void vm_page_bootstrap(
 
 	list_init(&vm_page_queue_fictitious);
 
-	/*
-	 *	Allocate (and initialize) the virtual-to-physical
-	 *	table hash buckets.
-	 *
-	 *	The number of buckets should be a power of two to
-	 *	get a good hash function.  The following computation
-	 *	chooses the first power of two that is greater
-	 *	than the number of physical pages in the system.
-	 */
-
-	if (vm_page_bucket_count == 0) {
-		unsigned long npages = vm_page_table_size();
-
-		vm_page_bucket_count = 1;
-		while (vm_page_bucket_count < npages)
-			vm_page_bucket_count <<= 1;
-	}
-
-	vm_page_hash_mask = vm_page_bucket_count - 1;
-
-	if (vm_page_hash_mask & vm_page_bucket_count)
-		printf("vm_page_bootstrap: WARNING -- strange page hash\n");
-
-	vm_page_buckets = (vm_page_bucket_t *)
-		pmap_steal_memory(vm_page_bucket_count *
-				  sizeof(vm_page_bucket_t));
-
-	for (i = 0; i < vm_page_bucket_count; i++) {
-		vm_page_bucket_t *bucket = &vm_page_buckets[i];
-
-		bucket->pages = VM_PAGE_NULL;
-		simple_lock_init(&bucket->lock);
-	}
-
 	vm_page_setup();
 
 	virtual_space_start = round_page(virtual_space_start);
@@ -295,16 +252,34 @@ void		vm_page_module_init(void)
 }
 
 /*
- *	vm_page_hash:
- *
- *	Distributes the object/offset key pair among hash buckets.
- *
- *	NOTE:	To get a good hash function, the bucket count should
- *		be a power of two.
+ *	Red-black tree lookup/insert comparison functions
+ *	for the resident pages of an object
  */
-#define vm_page_hash(object, offset) \
-	(((unsigned int)(vm_offset_t)object + (unsigned int)atop(offset)) \
-		& vm_page_hash_mask)
+static inline int vm_page_cmp_lookup(
+	vm_offset_t		offset,
+	const struct rbtree_node *node)
+{
+	vm_page_t	mem;
+
+	mem = rbtree_entry(node, struct vm_page, tree_node);
+
+	if (offset < mem->offset)
+		return -1;
+	else if (offset > mem->offset)
+		return 1;
+	else
+		return 0;
+}
+
+static inline int vm_page_cmp_insert(
+	const struct rbtree_node *a,
+	const struct rbtree_node *b)
+{
+	vm_page_t	mem;
+
+	mem = rbtree_entry(a, struct vm_page, tree_node);
+	return vm_page_cmp_lookup(mem->offset, b);
+}
 
 /*
  *	vm_page_insert:		[ internal use only ]
@@ -321,7 +296,8 @@ void vm_page_insert(
 	vm_object_t	object,
 	vm_offset_t	offset)
 {
-	vm_page_bucket_t *bucket;
+	struct rbtree_node *node;
+	unsigned long	slot;
 
 	VM_PAGE_CHECK(mem);
 
@@ -344,14 +320,14 @@ void vm_page_insert(
 	mem->offset = offset;
 
 	/*
-	 *	Insert it into the object_object/offset hash table
+	 *	Insert it into the page tree of the object
 	 */
 
-	bucket = &vm_page_buckets[vm_page_hash(object, offset)];
-	simple_lock(&bucket->lock);
-	mem->next = bucket->pages;
-	bucket->pages = mem;
-	simple_unlock(&bucket->lock);
+	node = rbtree_lookup_slot(&object->page_tree, offset,
+				  vm_page_cmp_lookup, slot);
+	if (node != NULL)
+		panic("vm_page_insert: page already present");
+	rbtree_insert_slot(&object->page_tree, slot, &mem->tree_node);
 
 	/*
 	 *	Now link into the object's list of backed pages.
@@ -399,7 +375,8 @@ void vm_page_replace(
 	vm_object_t	object,
 	vm_offset_t	offset)
 {
-	vm_page_bucket_t *bucket;
+	struct rbtree_node *node;
+	unsigned long	slot;
 
 	VM_PAGE_CHECK(mem);
 
@@ -422,50 +399,37 @@ void vm_page_replace(
 	mem->offset = offset;
 
 	/*
-	 *	Insert it into the object_object/offset hash table,
+	 *	Insert it into the page tree of the object,
 	 *	replacing any page that might have been there.
 	 */
 
-	bucket = &vm_page_buckets[vm_page_hash(object, offset)];
-	simple_lock(&bucket->lock);
-	if (bucket->pages) {
-		vm_page_t *mp = &bucket->pages;
-		vm_page_t m = *mp;
-		do {
-			if (m->object == object && m->offset == offset) {
-				/*
-				 * Remove page from bucket and from object,
-				 * and return it to the free list.
-				 */
-				*mp = m->next;
-				queue_remove(&object->memq, m, vm_page_t,
-					     listq);
-				m->tabled = FALSE;
-				object->resident_page_count--;
-				VM_PAGE_QUEUES_REMOVE(m);
-
-				if (m->external) {
-					m->external = FALSE;
-					vm_object_external_pages--;
-				}
-
-				/*
-				 * Return page to the free list.
-				 * Note the page is not tabled now, so this
-				 * won't self-deadlock on the bucket lock.
-				 */
-
-				vm_page_free(m);
-				break;
-			}
-			mp = &m->next;
-		} while ((m = *mp) != 0);
-		mem->next = bucket->pages;
-	} else {
-		mem->next = VM_PAGE_NULL;
+	node = rbtree_lookup_slot(&object->page_tree, offset,
+				  vm_page_cmp_lookup, slot);
+	if (node != NULL) {
+		vm_page_t m = rbtree_entry(node, struct vm_page, tree_node);
+
+		/*
+		 * Remove page from the tree and from object,
+		 * and return it to the free list.
+		 */
+		rbtree_remove(&object->page_tree, node);
+		queue_remove(&object->memq, m, vm_page_t, listq);
+		m->tabled = FALSE;
+		object->resident_page_count--;
+		VM_PAGE_QUEUES_REMOVE(m);
+
+		if (m->external) {
+			m->external = FALSE;
+			vm_object_external_pages--;
+		}
+
+		vm_page_free(m);
+
+		node = rbtree_lookup_slot(&object->page_tree, offset,
+					  vm_page_cmp_lookup, slot);
+		assert(node == NULL);
 	}
-	bucket->pages = mem;
-	simple_unlock(&bucket->lock);
+	rbtree_insert_slot(&object->page_tree, slot, &mem->tree_node);
 
 	/*
 	 *	Now link into the object's list of backed pages.
@@ -496,32 +460,14 @@ void vm_page_replace(
 void vm_page_remove(
 	vm_page_t		mem)
 {
-	vm_page_bucket_t	*bucket;
-	vm_page_t		this;
-
 	assert(mem->tabled);
 	VM_PAGE_CHECK(mem);
 
 	/*
-	 *	Remove from the object_object/offset hash table
+	 *	Remove from the page tree of the object
 	 */
 
-	bucket = &vm_page_buckets[vm_page_hash(mem->object, mem->offset)];
-	simple_lock(&bucket->lock);
-	if ((this = bucket->pages) == mem) {
-		/* optimize for common case */
-
-		bucket->pages = mem->next;
-	} else {
-		vm_page_t	*prev;
-
-		for (prev = &this->next;
-		     (this = *prev) != mem;
-		     prev = &this->next)
-			continue;
-		*prev = this->next;
-	}
-	simple_unlock(&bucket->lock);
+	rbtree_remove(&mem->object->page_tree, &mem->tree_node);
 
 	/*
 	 *	Now remove from the object's list of backed pages.
@@ -559,23 +505,68 @@ vm_page_t vm_page_lookup(
 	vm_object_t		object,
 	vm_offset_t		offset)
 {
+	struct rbtree_node	*node;
+
+	node = rbtree_lookup(&object->page_tree, offset, vm_page_cmp_lookup);
+	if (node == NULL)
+		return VM_PAGE_NULL;
+
+	return rbtree_entry(node, struct vm_page, tree_node);
+}
+
+/*
+ *	vm_page_lookup_range:
+ *
+ *	Returns the resident page of the object with the lowest
+ *	offset in [start, end); if none is found, VM_PAGE_NULL
+ *	is returned.  The following pages of the range are then
+ *	found in offset order with vm_page_next_range.
+ *
+ *	The object must be locked.  No side effects.
+ */
+
+vm_page_t vm_page_lookup_range(
+	vm_object_t		object,
+	vm_offset_t		start,
+	vm_offset_t		end)
+{
+	struct rbtree_node	*node;
 	vm_page_t		mem;
-	vm_page_bucket_t 	*bucket;
 
-	/*
-	 *	Search the hash table for this object/offset pair
-	 */
+	node = rbtree_lookup_nearest(&object->page_tree, start,
+				     vm_page_cmp_lookup, RBTREE_RIGHT);
+	if (node == NULL)
+		return VM_PAGE_NULL;
 
-	bucket = &vm_page_buckets[vm_page_hash(object, offset)];
+	mem = rbtree_entry(node, struct vm_page, tree_node);
+	return (mem->offset < end) ? mem : VM_PAGE_NULL;
+}
 
-	simple_lock(&bucket->lock);
-	for (mem = bucket->pages; mem != VM_PAGE_NULL; mem = mem->next) {
-		VM_PAGE_CHECK(mem);
-		if ((mem->object == object) && (mem->offset == offset))
-			break;
-	}
-	simple_unlock(&bucket->lock);
-	return mem;
+/*
+ *	vm_page_next_range:
+ *
+ *	Returns the resident page following the given one in
+ *	its object, if its offset is below end; VM_PAGE_NULL
+ *	otherwise.
+ *
+ *	The object must be locked, and the given page must
+ *	still be in it.  No side effects.
+ */
+
+vm_page_t vm_page_next_range(
+	vm_page_t		mem,
+	vm_offset_t		end)
+{
+	struct rbtree_node	*node;
+
+	assert(mem->tabled);
+
+	node = rbtree_next(&mem->tree_node);
+	if (node == NULL)
+		return VM_PAGE_NULL;
+
+	mem = rbtree_entry(node, struct vm_page, tree_node);
+	return (mem->offset < end) ? mem : VM_PAGE_NULL;
 }
 
 /*
@@ -794,6 +785,36 @@ vm_page_t vm_page_grab(void)
 	return mem;
 }
 
+/*
+ *	vm_page_grab_zeroed:
+ *
+ *	Remove a page from the free list, preferably one that
+ *	idle processors have already filled with zeros, in which
+ *	case zeroed is set to TRUE.  Otherwise the caller must
+ *	fill the page itself.
+ */
+
+vm_page_t vm_page_grab_zeroed(
+	boolean_t	*zeroed)
+{
+	vm_page_t	mem;
+
+	simple_lock(&vm_page_queue_free_lock);
+	mem = vm_page_alloc_zeroed(VM_PAGE_SEL_DIRECTMAP, VM_PT_KERNEL);
+
+	if (mem == NULL) {
+		simple_unlock(&vm_page_queue_free_lock);
+		*zeroed = FALSE;
+		return vm_page_grab();
+	}
+
+	mem->free = FALSE;
+	simple_unlock(&vm_page_queue_free_lock);
+
+	*zeroed = TRUE;
+	return mem;
+}
+
 phys_addr_t vm_page_grab_phys_addr(void)
 {
 	vm_page_t p = vm_page_grab();
@@ -1020,6 +1041,9 @@ void vm_page_copy(
  *		Return information about the global VP table.
  *		Fills the buffer with as much information as possible
  *		and returns the desired size of the buffer.
+ *
+ *		Resident pages are now indexed by a tree in each
+ *		object, so there are no buckets to report.
  *	Conditions:
  *		Nothing locked.  The caller should provide
  *		possibly-pageable memory.
@@ -1030,26 +1054,10 @@ vm_page_info(
 	hash_info_bucket_t *info,
 	unsigned int	count)
 {
-	int i;
-
-	if (vm_page_bucket_count < count)
-		count = vm_page_bucket_count;
-
-	for (i = 0; i < count; i++) {
-		vm_page_bucket_t *bucket = &vm_page_buckets[i];
-		unsigned int bucket_count = 0;
-		vm_page_t m;
-
-		simple_lock(&bucket->lock);
-		for (m = bucket->pages; m != VM_PAGE_NULL; m = m->next)
-			bucket_count++;
-		simple_unlock(&bucket->lock);
-
-		/* don't touch pageable memory while holding locks */
-		info[i].hib_count = bucket_count;
-	}
+	(void) info;
+	(void) count;
 
-	return vm_page_bucket_count;
+	return 0;
 }
 #endif	/* MACH_VM_DEBUG */
 
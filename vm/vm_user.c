@@ -48,6 +48,7 @@
 #include <vm/vm_map.h>
 #include <vm/vm_object.h>
 #include <vm/memory_object_proxy.h>
+#include <vm/vm_channel.h>
 #include <vm/vm_page.h>
 
 
@@ -215,6 +216,23 @@ kern_return_t vm_cache_statistics(
 	return KERN_SUCCESS;
 }
 
+/*
+ *	Return the refault counts of the page cache, see
+ *	vm_page_refault.
+ */
+kern_return_t vm_refault_info(
+	host_t		host,
+	natural_t	*refaults,
+	natural_t	*workingset_refaults)
+{
+	if (host == HOST_NULL)
+		return KERN_INVALID_HOST;
+
+	*refaults = vm_page_refaults;
+	*workingset_refaults = vm_page_workingset_refaults;
+	return KERN_SUCCESS;
+}
+
 /*
  * Handle machine-specific attributes for a mapping, such
  * as cachability, migrability, etc.
@@ -346,6 +364,8 @@ kern_return_t vm_map(
 		offset = 0;
 		copy = FALSE;
 	} else if ((object = vm_object_enter(memory_object, size, FALSE))
+			== VM_OBJECT_NULL
+		   && (object = vm_channel_lookup(memory_object))
 			== VM_OBJECT_NULL)
 	  {
 	    ipc_port_t real_memobj;
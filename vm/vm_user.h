@@ -48,6 +48,7 @@ extern kern_return_t	vm_protect(vm_map_t, vm_offset_t, vm_size_t, boolean_t,
 				   vm_prot_t);
 extern kern_return_t	vm_statistics(vm_map_t, vm_statistics_data_t *);
 extern kern_return_t	vm_cache_statistics(vm_map_t, vm_cache_statistics_data_t *);
+extern kern_return_t	vm_refault_info(host_t, natural_t *, natural_t *);
 extern kern_return_t	vm_read(vm_map_t, vm_address_t, vm_size_t, pointer_t *,
 				vm_size_t *);
 extern kern_return_t	vm_write(vm_map_t, vm_address_t, pointer_t, vm_size_t);